@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * busefb ioctls, issued on the /dev/fbN of a busefb display.
+ */
+#ifndef _UAPI_BUSEFB_H
+#define _UAPI_BUSEFB_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * VRAM rectangle written through mmap, in virtual coordinates (yoffset
+ * included). Once used, deferred IO page tracking is ignored until the
+ * device is closed, so report every change.
+ */
+struct busefb_damage {
+    __u32 x;
+    __u32 y;
+    __u32 width;
+    __u32 height;
+};
+
+/*
+ * Raw pass-through. mmap size bytes at offset on the fb device and fill
+ * them in the panels' own format: planes bit-planes (bits_per_pixel) of
+ * groups groups, group g of plane p at (p * groups + g) * group_bytes,
+ * each group the SPI bytes that go out for it including the group select
+ * byte in front of every panel. RAW_COMMIT copies it to the scan, from
+ * then on VRAM writes are not shown until RAW_EXIT or a depth change.
+ */
+struct busefb_raw_info {
+    __u64 offset;
+    __u32 size;
+    __u32 group_bytes;
+    __u32 groups;
+    __u32 planes;
+};
+
+/*
+ * Timed presentation: data points to one screen in the current format,
+ * xres * yres pixels packed like VRAM would be without a wider virtual
+ * width ((xres * yres * bits_per_pixel + 7) / 8 bytes). It is encoded
+ * right away and goes on air at the first frame boundary at or after
+ * present_ns (CLOCK_MONOTONIC). Frames overtaken by a later due one are
+ * dropped. 0 means as soon as possible: the next boundary, or with the
+ * newest frame still queued, which it then overtakes. Times earlier
+ * than a frame still queued are rejected, frames already on air don't
+ * count. QUEUE_FRAME blocks while the queue is full, and fails with
+ * EAGAIN if it is full and the scan stops (blanked, say). While frames
+ * are queued, VRAM writes are not shown. QUEUE_FLUSH drops what is
+ * still waiting.
+ */
+struct busefb_timed_frame {
+    __u64 present_ns;
+    __u64 data;
+};
+
+/*
+ * Looped playback: count frames, durations[i] ms each, played round and
+ * round by the driver with no further help from userspace, loops times
+ * (0 until LOOP_STOP or the next LOOP). frames points to them back to
+ * back, in the raw format of BUSEFB_IOCTL_RAW_INFO (size bytes each), or
+ * with BUSEFB_LOOP_VRAM as screens like QUEUE_FRAME takes, encoded
+ * once at upload. Durations are rounded up to whole scan frames. Timed
+ * frames go over the loop while any are queued; once the loop is done
+ * the display goes back to VRAM.
+ */
+struct busefb_loop {
+    __u64 frames;
+    __u64 durations;
+    __u32 count;
+    __u32 loops;
+    __u32 flags;
+    __u32 reserved;
+};
+
+#define BUSEFB_LOOP_VRAM (1 << 0)
+
+#define BUSEFB_IOC_MAGIC 'B'
+
+#define BUSEFB_IOCTL_DAMAGE _IOW(BUSEFB_IOC_MAGIC, 0x01, struct busefb_damage)
+#define BUSEFB_IOCTL_RAW_INFO _IOR(BUSEFB_IOC_MAGIC, 0x02, struct busefb_raw_info)
+#define BUSEFB_IOCTL_RAW_COMMIT _IO(BUSEFB_IOC_MAGIC, 0x03)
+#define BUSEFB_IOCTL_RAW_EXIT _IO(BUSEFB_IOC_MAGIC, 0x04)
+#define BUSEFB_IOCTL_QUEUE_FRAME _IOW(BUSEFB_IOC_MAGIC, 0x05, \
+                                      struct busefb_timed_frame)
+#define BUSEFB_IOCTL_QUEUE_FLUSH _IO(BUSEFB_IOC_MAGIC, 0x06)
+#define BUSEFB_IOCTL_LOOP _IOW(BUSEFB_IOC_MAGIC, 0x07, struct busefb_loop)
+#define BUSEFB_IOCTL_LOOP_STOP _IO(BUSEFB_IOC_MAGIC, 0x08)
+
+#endif /* _UAPI_BUSEFB_H */
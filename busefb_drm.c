@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * DRM front end for busefb, registered instead of the fbdev device with
+ * "make DRM=1" (kernel with CONFIG_DRM_KMS_HELPER and
+ * CONFIG_DRM_GEM_SHMEM_HELPER). Linked into the module next to
+ * busefb_main.c, it sits on the same VRAM, encoder and scan as the
+ * fbdev ops, through the calls in busefb_internal.h.
+ *
+ * One fixed mode, one XRGB8888 plane. Updates are converted to gray
+ * into 8bpp VRAM page 0 clip by clip and damaged like drawing ops, so
+ * plane damage clips re-encode only their blocks and the dither setting
+ * applies. Vblank is the scan frame boundary: a commit's event is armed
+ * once its frame is published, so it fires when that frame goes on air.
+ * Enabling and disabling the pipe unblanks and blanks the panels.
+ */
+
+#include <linux/fb.h>
+#include <linux/version.h>
+
+#include <drm/drm_atomic_helper.h>
+#include <drm/drm_connector.h>
+#include <drm/drm_damage_helper.h>
+#include <drm/drm_drv.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_format_helper.h>
+#include <drm/drm_framebuffer.h>
+#include <drm/drm_gem_atomic_helper.h>
+#include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_gem_shmem_helper.h>
+#include <drm/drm_modes.h>
+#include <drm/drm_probe_helper.h>
+#include <drm/drm_simple_kms_helper.h>
+#include <drm/drm_vblank.h>
+
+#include "busefb_internal.h"
+
+struct busefb_drm {
+    struct drm_device drm;
+    struct drm_simple_display_pipe pipe;
+    struct drm_connector connector;
+    struct drm_display_mode mode;
+    struct fb_info *info;           /* the core's, VRAM and blanking */
+};
+
+static struct busefb_drm *to_busefb_drm(struct drm_device *drm)
+{
+    return container_of(drm, struct busefb_drm, drm);
+}
+
+static const u32 busefb_drm_formats[] = {
+    DRM_FORMAT_XRGB8888,
+};
+
+/* Frame boundary: the scan's vblank, from any scan context */
+void busefb_drm_vblank(struct busefb_drm *bd)
+{
+    drm_crtc_handle_vblank(&bd->pipe.crtc);
+}
+
+/* One damage clip into VRAM as 8bpp gray, damaged like a drawing op */
+static void busefb_drm_blit(struct busefb_drm *bd,
+                            struct drm_framebuffer *fb,
+                            struct drm_shadow_plane_state *shadow,
+                            const struct drm_rect *clip)
+{
+    const struct iosys_map *src = &shadow->data[0];
+    struct fb_info *info = bd->info;
+    unsigned int pitch = info->fix.line_length;
+    struct iosys_map dst;
+
+    iosys_map_set_vaddr(&dst, info->screen_base);
+    iosys_map_incr(&dst, clip->y1 * pitch + clip->x1);
+
+    busefb_vram_begin(info);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+    drm_fb_xrgb8888_to_gray8(&dst, &pitch, src, fb, clip,
+                             &shadow->fmtcnv_state);
+#else
+    drm_fb_xrgb8888_to_gray8(&dst, &pitch, src, fb, clip);
+#endif
+    busefb_touch(info, clip->x1, clip->y1, drm_rect_width(clip),
+                 drm_rect_height(clip));
+    busefb_vram_end(info);
+}
+
+/* Deliver the commit's event at the next vblank, or now if off */
+static void busefb_drm_event(struct drm_crtc *crtc)
+{
+    struct drm_pending_vblank_event *event = crtc->state->event;
+
+    if (!event)
+        return;
+
+    crtc->state->event = NULL;
+    spin_lock_irq(&crtc->dev->event_lock);
+    if (crtc->state->active && !drm_crtc_vblank_get(crtc))
+        drm_crtc_arm_vblank_event(crtc, event);
+    else
+        drm_crtc_send_vblank_event(crtc, event);
+    spin_unlock_irq(&crtc->dev->event_lock);
+}
+
+static void busefb_pipe_update(struct drm_simple_display_pipe *pipe,
+                               struct drm_plane_state *old_state)
+{
+    struct busefb_drm *bd = to_busefb_drm(pipe->crtc.dev);
+    struct drm_plane_state *state = pipe->plane.state;
+    struct drm_shadow_plane_state *shadow = to_drm_shadow_plane_state(state);
+    struct drm_framebuffer *fb = state->fb;
+    struct drm_atomic_helper_damage_iter iter;
+    struct drm_rect clip;
+    int idx;
+
+    if (fb && pipe->crtc.state->active &&
+        drm_dev_enter(&bd->drm, &idx)) {
+        if (!drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE)) {
+            drm_atomic_helper_damage_iter_init(&iter, old_state, state);
+            drm_atomic_for_each_plane_damage(&iter, &clip)
+                busefb_drm_blit(bd, fb, shadow, &clip);
+            drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+        }
+
+        /* Encoded and in next, so the next boundary puts it on air */
+        busefb_flush(bd->info);
+        drm_dev_exit(idx);
+    }
+
+    busefb_drm_event(&pipe->crtc);
+}
+
+static void busefb_pipe_enable(struct drm_simple_display_pipe *pipe,
+                               struct drm_crtc_state *crtc_state,
+                               struct drm_plane_state *plane_state)
+{
+    struct busefb_drm *bd = to_busefb_drm(pipe->crtc.dev);
+    int idx;
+
+    if (!drm_dev_enter(&bd->drm, &idx))
+        return;
+
+    busefb_blank(FB_BLANK_UNBLANK, bd->info);
+    drm_crtc_vblank_on(&pipe->crtc);
+    drm_dev_exit(idx);
+}
+
+static void busefb_pipe_disable(struct drm_simple_display_pipe *pipe)
+{
+    struct busefb_drm *bd = to_busefb_drm(pipe->crtc.dev);
+    int idx;
+
+    drm_crtc_vblank_off(&pipe->crtc);
+    if (!drm_dev_enter(&bd->drm, &idx))
+        return;
+
+    busefb_blank(FB_BLANK_POWERDOWN, bd->info);
+    drm_dev_exit(idx);
+}
+
+/* The scan always runs while enabled, nothing to switch */
+static int busefb_pipe_enable_vblank(struct drm_simple_display_pipe *pipe)
+{
+    return 0;
+}
+
+static void busefb_pipe_disable_vblank(struct drm_simple_display_pipe *pipe)
+{
+}
+
+static enum drm_mode_status
+busefb_pipe_mode_valid(struct drm_simple_display_pipe *pipe,
+                       const struct drm_display_mode *mode)
+{
+    struct busefb_drm *bd = to_busefb_drm(pipe->crtc.dev);
+
+    return drm_crtc_helper_mode_valid_fixed(&pipe->crtc, mode, &bd->mode);
+}
+
+static const struct drm_simple_display_pipe_funcs busefb_pipe_funcs = {
+    .mode_valid = busefb_pipe_mode_valid,
+    .enable = busefb_pipe_enable,
+    .disable = busefb_pipe_disable,
+    .update = busefb_pipe_update,
+    .enable_vblank = busefb_pipe_enable_vblank,
+    .disable_vblank = busefb_pipe_disable_vblank,
+    DRM_GEM_SIMPLE_DISPLAY_PIPE_SHADOW_PLANE_FUNCS,
+};
+
+static int busefb_connector_get_modes(struct drm_connector *connector)
+{
+    struct busefb_drm *bd = to_busefb_drm(connector->dev);
+
+    return drm_connector_helper_get_modes_fixed(connector, &bd->mode);
+}
+
+static const struct drm_connector_helper_funcs busefb_connector_hfuncs = {
+    .get_modes = busefb_connector_get_modes,
+};
+
+static const struct drm_connector_funcs busefb_connector_funcs = {
+    .reset = drm_atomic_helper_connector_reset,
+    .fill_modes = drm_helper_probe_single_connector_modes,
+    .destroy = drm_connector_cleanup,
+    .atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
+    .atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
+};
+
+static const struct drm_mode_config_funcs busefb_mode_config_funcs = {
+    .fb_create = drm_gem_fb_create_with_dirty,
+    .atomic_check = drm_atomic_helper_check,
+    .atomic_commit = drm_atomic_helper_commit,
+};
+
+DEFINE_DRM_GEM_FOPS(busefb_drm_fops);
+
+static const struct drm_driver busefb_drm_driver = {
+    .driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+    .fops = &busefb_drm_fops,
+    DRM_GEM_SHMEM_DRIVER_OPS,
+    .name = "busefb",
+    .desc = "Buse SPI LED panels",
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 14, 0)
+    .date = "20260101",
+#endif
+    .major = 1,
+    .minor = 0,
+};
+
+/*
+ * A width x height card on info's device. The drm_device is device
+ * managed and may outlive info while files are open; drm_dev_enter()
+ * keeps the callbacks off it once unplugged.
+ */
+struct busefb_drm *busefb_drm_register(struct fb_info *info, u32 width,
+                                       u32 height)
+{
+    struct busefb_drm *bd;
+    struct drm_device *drm;
+    int ret;
+
+    bd = devm_drm_dev_alloc(info->device, &busefb_drm_driver,
+                            struct busefb_drm, drm);
+    if (IS_ERR(bd))
+        return bd;
+    bd->info = info;
+    drm = &bd->drm;
+
+    ret = drmm_mode_config_init(drm);
+    if (ret)
+        return ERR_PTR(ret);
+
+    drm->mode_config.min_width = width;
+    drm->mode_config.max_width = width;
+    drm->mode_config.min_height = height;
+    drm->mode_config.max_height = height;
+    drm->mode_config.funcs = &busefb_mode_config_funcs;
+
+    bd->mode = (struct drm_display_mode){
+        DRM_SIMPLE_MODE(width, height, 0, 0)
+    };
+
+    ret = drm_connector_init(drm, &bd->connector, &busefb_connector_funcs,
+                             DRM_MODE_CONNECTOR_SPI);
+    if (ret)
+        return ERR_PTR(ret);
+    drm_connector_helper_add(&bd->connector, &busefb_connector_hfuncs);
+
+    ret = drm_simple_display_pipe_init(drm, &bd->pipe, &busefb_pipe_funcs,
+                                       busefb_drm_formats,
+                                       ARRAY_SIZE(busefb_drm_formats),
+                                       NULL, &bd->connector);
+    if (ret)
+        return ERR_PTR(ret);
+    drm_plane_enable_fb_damage_clips(&bd->pipe.plane);
+
+    ret = drm_vblank_init(drm, 1);
+    if (ret)
+        return ERR_PTR(ret);
+
+    drm_mode_config_reset(drm);
+
+    ret = drm_dev_register(drm, 0);
+    return ret ? ERR_PTR(ret) : bd;
+}
+
+/* Scan still running, stopped by the caller afterwards */
+void busefb_drm_unregister(struct busefb_drm *bd)
+{
+    struct drm_device *drm = &bd->drm;
+
+    drm_dev_unplug(drm);
+    drm_atomic_helper_shutdown(drm);
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Between the busefb core (busefb_main.c) and the DRM front end
+ * (busefb_drm.c, make DRM=1). The core's entry points take its fb_info,
+ * registered or not; the front end's take what it registered.
+ */
+#ifndef _BUSEFB_INTERNAL_H
+#define _BUSEFB_INTERNAL_H
+
+#include <linux/fb.h>
+#include <linux/types.h>
+
+struct busefb_drm;
+
+/* busefb_main.c: damage VRAM, bracket writes to it, blank the panels */
+void busefb_touch(struct fb_info *info, u32 x, u32 y, u32 w, u32 h);
+void busefb_vram_begin(struct fb_info *info);
+void busefb_vram_end(struct fb_info *info);
+void busefb_flush(struct fb_info *info);
+int busefb_blank(int blank, struct fb_info *info);
+
+#ifdef BUSEFB_DRM
+/* busefb_drm.c */
+struct busefb_drm *busefb_drm_register(struct fb_info *info, u32 width,
+                                       u32 height);
+void busefb_drm_unregister(struct busefb_drm *bd);
+void busefb_drm_vblank(struct busefb_drm *bd);
+#else
+static inline void busefb_drm_vblank(struct busefb_drm *bd) {}
+#endif
+
+#endif /* _BUSEFB_INTERNAL_H */
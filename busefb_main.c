@@ -0,0 +1,4136 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Buse SPI framebuffer driver
+ * Supports:
+ *   - 128x19 (4x32)
+ *   - 144x19 (4x32 + 16 half panel at end of chain)
+ *   - any chain of panels with widths a multiple of 4, some of them
+ *     mounted upside down (DT panel-widths / panel-rotation)
+ *
+ * This is the core: encoder, scan and fbdev front end. The DRM front
+ * end (make DRM=1) is busefb_drm.c, see busefb_internal.h.
+ *
+ * Mapping:
+ *  - 4 column groups (grp = x % 4)
+ *  - FIFO shift-register cascade (panels reversed in buffer)
+ *  - Column-pair mirroring within each panel (cp reversed, grp preserved)
+ */
+
+#include <linux/module.h>
+#include <linux/spi/spi.h>
+#include <linux/fb.h>
+#include <linux/of.h>
+#include <linux/gpio/consumer.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/bitrev.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/wait.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+#include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include <linux/compat.h>
+
+#include "busefb.h"
+#include "busefb_internal.h"
+
+#define CREATE_TRACE_POINTS
+#include "busefb_trace.h"
+
+#define GROUPS 4
+#define DISPLAY_BRIGHTNESS_USEC 50
+#define VRAM_PAGES_DEFAULT 2
+#define VRAM_PAGES_MAX 16
+#define VIRTUAL_WIDTH_MAX 8192
+#define TX_FRAMES 3
+/* timed frame queue slots, one of them may be on air */
+#define QUEUE_FRAMES 8
+/* BUSEFB_IOCTL_LOOP ring size limit */
+#define LOOP_FRAMES_MAX 256
+/* grayscale: one BCM bit-plane per VRAM bit, up to 4bpp */
+#define PLANES_MAX 4
+/* scan sequence length limit, in groups */
+#define SCAN_SEQ_MAX 32
+/* panel_widths and height limits, sysfs */
+#define PANELS_MAX 64
+#define HEIGHT_MAX 256
+/* deepest VRAM format, 8bpp is dithered down to one plane */
+#define VRAM_BPP_MAX 8
+/* scan thread sleeps until this close to the end of a dwell, then spins */
+#define THREAD_SPIN_USEC 10
+/* FBIO_WAITFORVSYNC gives up after this, e.g. when blanked */
+#define VSYNC_TIMEOUT_MS 2000
+/* governor: no change for this long drops the scan to idle_rate */
+#define IDLE_TIMEOUT_MS_DEFAULT 1000
+/* auto-scroll speed limit, pixels per second */
+#define SCROLL_SPEED_MAX 10000
+
+enum busefb_engine {
+    BUSEFB_ENGINE_ASYNC,    /* spi_async + hrtimer chain */
+    BUSEFB_ENGINE_THREAD,   /* SCHED_FIFO kthread owning the group loop */
+    BUSEFB_ENGINE_NATIVE,   /* one message per frame, controller CS */
+};
+
+static const char * const busefb_engine_names[] = {
+    [BUSEFB_ENGINE_ASYNC] = "async",
+    [BUSEFB_ENGINE_THREAD] = "thread",
+    [BUSEFB_ENGINE_NATIVE] = "native",
+};
+
+enum busefb_dither {
+    BUSEFB_DITHER_ORDERED,      /* fixed 8x8 Bayer thresholds */
+    BUSEFB_DITHER_TEMPORAL,     /* Bayer phase moved every scan frame */
+};
+
+static const char * const busefb_dither_names[] = {
+    [BUSEFB_DITHER_ORDERED] = "ordered",
+    [BUSEFB_DITHER_TEMPORAL] = "temporal",
+};
+
+struct busefb_pixel {
+    u16 off;    /* byte offset into the encoded frame */
+    u8 mask;    /* bit to set at that offset */
+};
+
+/* Pixel rectangle [x1, x2) x [y1, y2), empty when x1 >= x2 or y1 >= y2 */
+struct busefb_rect {
+    u32 x1, y1;
+    u32 x2, y2;
+};
+
+/* col_off flag: column of an upside down panel, registers run backwards */
+#define BUSEFB_COL_FLIP BIT(15)
+
+struct busefb_panel {
+    u32 x;          /* first image column */
+    u32 width;      /* multiple of GROUPS */
+    bool flip;      /* mounted rotated by 180 degrees */
+    u32 off;        /* offset of its slot within each group */
+};
+
+struct busefb_config {
+    u32 width;
+    u32 height;
+
+    /*
+     * Panels in image order, left to right. The chain is a FIFO, so
+     * per-group SPI order is the reverse: [panel n-1]..[panel1][panel0].
+     */
+    u32 num_panels;
+    struct busefb_panel *panels;
+    bool any_flip;
+
+    u32 regs_per_col;
+
+    u32 group_bytes;
+    u32 frame_bytes;     /* one bit-plane, GROUPS * group_bytes */
+
+    u32 bpp;             /* VRAM bits per pixel = encoded planes */
+
+    /*
+     * Scan order of a frame, seq_len groups with every group the same
+     * number of times (0 1 2 3 by default). Changed with the scan
+     * stopped, the native messages are built from it.
+     */
+    u8 seq[SCAN_SEQ_MAX];
+    u32 seq_len;
+
+    /* lookup tables, built once at probe */
+    u16 *col_off;                    /* per column offset of register 0,
+                                        | BUSEFB_COL_FLIP */
+    struct busefb_pixel *pixel_map;  /* per pixel, unaligned widths only */
+
+    /*
+     * Re-encode the part of frame covering r (screen coordinates, not
+     * empty). The rest of frame is left as it was.
+     */
+    void (*encode)(const struct busefb_config *cfg, const u8 *vram,
+                   u8 *frame, const struct busefb_rect *r);
+};
+
+/*
+ * One encoded SPI frame: cfg.bpp planes of frame_bytes, group g of plane
+ * p at (p * GROUPS + g) * group_bytes, plus the messages that send it.
+ * Those are built (and optimized) once when the frame is prepared: one
+ * message per group and plane for the GPIO engines, indexed the same
+ * way, and one message for the whole scan sequence for the native
+ * engine. buf is kmalloc'd, so it is physically contiguous and DMA-safe:
+ * controllers map a group as one segment instead of bouncing or falling
+ * back to PIO for vmalloc pages.
+ */
+struct busefb_frame {
+    u8 *buf;
+    ktime_t since;  /* oldest VRAM write in it, 0 for none */
+    u32 msgs;       /* prepared group messages, GROUPS * bpp */
+    u32 steps;      /* scan steps in native_msg, seq_len * bpp */
+
+    struct spi_transfer group_xfer[PLANES_MAX * GROUPS];
+    struct spi_message group_msg[PLANES_MAX * GROUPS];
+
+    struct spi_transfer *native_xfer;   /* steps of them */
+    struct spi_message native_msg;
+};
+
+/* min/avg/max of a duration, in ns */
+struct busefb_time_stat {
+    u64 count;
+    u64 total;
+    u64 min;
+    u64 max;
+};
+
+/* Upper bounds (usecs) of the dwell overshoot histogram, plus one overflow */
+static const u32 busefb_dwell_hist_us[] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500
+};
+
+/*
+ * Timing counters for debugfs. Updated by the encoder and from every
+ * scan context (hard irq included), so all under lock.
+ */
+struct busefb_stats {
+    spinlock_t lock;
+
+    u64 frames_encoded;
+    u64 frames_skipped;     /* replaced in next before being scanned */
+    u64 frames_torn;        /* dropped, VRAM was written meanwhile */
+    u64 frames_scanned;
+
+    struct busefb_time_stat encode;
+    struct busefb_time_stat latency;    /* VRAM write to its frame on air */
+    struct busefb_time_stat xfer;       /* one step, GPIO engines */
+    struct busefb_time_stat dwell_late; /* CS off time past the request */
+    u64 dwell_hist[ARRAY_SIZE(busefb_dwell_hist_us) + 1];
+
+    ktime_t fps_start;
+    u32 fps_frames;
+    u32 fps;                /* frames scanned over the last second */
+};
+
+struct busefb_par {
+    struct spi_device *spi;
+    struct fb_info *info;
+    struct gpio_desc *cs_gpio;
+
+    struct workqueue_struct *wq;
+    struct work_struct refresh_work;
+    struct hrtimer cs_delay_timer;
+
+    struct fb_deferred_io defio;
+
+    struct busefb_config cfg;
+
+    /*
+     * Triple buffered encoded frames. tx is being scanned out, next is
+     * the newest finished encode waiting for a frame boundary, the third
+     * one belongs to the encoder. scan_lock guards tx/next.
+     */
+    struct busefb_frame frames[TX_FRAMES];
+    struct busefb_frame *tx;
+    struct busefb_frame *next;
+    spinlock_t scan_lock;
+
+    /*
+     * Timed frame queue, BUSEFB_IOCTL_QUEUE_FRAME. Slots q_head onwards
+     * (q_count of them, non-decreasing q_time) wait for their time; the
+     * frame boundary puts the latest due one on air. While the queue is
+     * not empty it owns the display, next waits. Ring state under
+     * scan_lock, slot contents under enc_mutex.
+     */
+    struct busefb_frame *queue;     /* QUEUE_FRAMES */
+    ktime_t q_time[QUEUE_FRAMES];
+    u32 q_head;
+    u32 q_count;
+    ktime_t q_last;                 /* time of the newest queued frame */
+    wait_queue_head_t queue_wait;
+    u8 *q_vram;                     /* one page in, for the encoder */
+
+    /*
+     * Loop playback, BUSEFB_IOCTL_LOOP: loop_n frames encoded at upload,
+     * frame i on air for loop_ms[i], loop_loops times round (0 for ever).
+     * While loop_playing and the queue is empty it owns the display. Set
+     * up and freed with the scan stopped, position under scan_lock.
+     */
+    struct busefb_frame *loop;
+    u32 *loop_ms;
+    u32 loop_n;
+    u32 loop_loops;
+    u32 loop_left;
+    int loop_pos;
+    ktime_t loop_due;
+    bool loop_playing;
+
+    /*
+     * Frame boundaries, for FBIO_WAITFORVSYNC and pollers of the vsync
+     * sysfs file (vsync_kn). Written under scan_lock.
+     */
+    u32 vsync_count;
+    ktime_t vsync_time;
+    wait_queue_head_t vsync_wait;
+    struct kernfs_node *vsync_kn;
+
+    /* serialises encodes against depth changes */
+    struct mutex enc_mutex;
+
+    /*
+     * VRAM is sized for vram_pages pages at the deepest format, pages of
+     * the current format are page_bytes apart and the encoder reads
+     * front_page in place.
+     */
+    u32 page_bytes;
+    u32 vram_pages;
+    u32 front_page;
+
+    /*
+     * Horizontal panning: VRAM rows are virtual_width wide and the
+     * screen shows cfg.width of them from xoffset on, wrapping round the
+     * end when auto-scrolling at scroll_speed px/s from scroll_start
+     * (positive moves the content left). Pan state under pan_lock.
+     * Unless the view is the plain page, it is gathered into window for
+     * the encoder; encoded_x is where master was encoded from.
+     */
+    u32 virtual_width;
+    spinlock_t pan_lock;
+    u32 xoffset;
+    int scroll_speed;
+    ktime_t scroll_start;
+    u32 encoded_x;
+    u8 *window;
+
+    /*
+     * VRAM depth, cfg.bpp but for 8bpp, which is dithered into window
+     * as 1bpp. With the temporal dither the threshold phase follows the
+     * frame count, encoded_phase is the one in master.
+     */
+    u32 vram_bpp;
+    enum busefb_dither dither;
+    u32 encoded_phase;
+
+    /*
+     * Bumped on every VRAM write, compared against what was encoded.
+     * write() and the drawing ops also bump it as they start and count
+     * in vram_writers while they run, seqcount style: an encode that
+     * started during a write waits for it, one that a write overlapped
+     * sees vram_gen move and is dropped rather than published torn.
+     */
+    atomic_t vram_gen;
+    atomic_t vram_writers;
+    int encoded_gen;
+    /* Part of master a dropped encode left, screen coordinates, enc_mutex */
+    struct busefb_rect torn;
+
+    /*
+     * VRAM area written since the last encode, virtual coordinates. The
+     * encoder refreshes that part of master, the always current encode
+     * of the front page, and copies master into the frame it publishes.
+     * Once a client reports damage by ioctl, deferred IO pages (which
+     * usually cover the whole screen) are ignored until it closes.
+     */
+    spinlock_t damage_lock;
+    struct busefb_rect damage;
+    ktime_t damage_time;            /* first write of damage */
+    ktime_t unpublished;            /* oldest write in master, not on its way */
+    bool explicit_damage;
+    u8 *master;
+
+    /*
+     * Raw pass-through: userspace maps raw (after VRAM) and fills it in
+     * the encoded layout, BUSEFB_IOCTL_RAW_COMMIT puts it on air. While
+     * raw_mode is set VRAM changes are not encoded.
+     */
+    u8 *raw;
+    bool raw_mode;
+
+    /* SPI clock of every transfer, spi_speed_hz in sysfs */
+    u32 speed_hz;
+
+    /* opens of the fb, mappings included; under the fb lock */
+    u32 users;
+
+    /* scan engine, switched at runtime under scan_mutex */
+    struct mutex scan_mutex;
+    enum busefb_engine engine;
+    bool scanning;
+    int scan_cpu;                   /* thread engine CPU, -1 for any */
+    bool blanked;                   /* FB_BLANK_*: scan parked, panels dark */
+
+    /* DRM front end instead of fbdev, make DRM=1 (busefb_drm.c) */
+    struct busefb_drm *drm;
+
+    /* thread engine: chain on a shared per-controller scan thread */
+    struct busefb_bus *bus;
+    struct list_head bus_node;
+    ktime_t due;                    /* next event of this chain */
+    bool dwell_pending;             /* CS is low, due ends the dwell */
+    s64 step_ns;                    /* last step on the bus, CS to CS */
+
+    /*
+     * Governor: frames start at most refresh_rate times a second, or
+     * idle_rate once nothing changed for idle_timeout_ms (0 = as fast
+     * as the bus goes / no idle throttling). Read from the scan without
+     * locks.
+     */
+    u32 refresh_rate;
+    u32 idle_rate;
+    u32 idle_timeout_ms;
+    ktime_t frame_start;
+    ktime_t last_change;            /* last frame boundary with a new frame */
+    bool in_gap;                    /* cs_delay_timer is timing a frame gap */
+
+    /* step timing, CS edges of the GPIO engines */
+    ktime_t xfer_start;
+    ktime_t dwell_start;
+
+    struct busefb_stats stats;
+    struct dentry *debugfs;
+
+    /* async scan state, driven from SPI completion and cs_delay_timer */
+    struct spi_message *cur_msg;
+
+    /* native engine: group 0 all off, latched before a frame gap */
+    u8 *blank;
+    struct spi_transfer blank_xfer;
+    struct spi_message blank_msg;
+    u32 current_step;
+    bool stopping;
+    struct completion scan_done;
+};
+
+/* ---------- Statistics ---------- */
+
+static void busefb_time_stat_add(struct busefb_time_stat *t, u64 ns)
+{
+    if (!t->count || ns < t->min)
+        t->min = ns;
+    if (ns > t->max)
+        t->max = ns;
+    t->total += ns;
+    t->count++;
+}
+
+static void busefb_stats_reset(struct busefb_stats *st)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&st->lock, flags);
+    memset_startat(st, 0, frames_encoded);
+    st->fps_start = ktime_get();
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+static void busefb_stats_encode(struct busefb_par *par, ktime_t start,
+                                bool skipped)
+{
+    struct busefb_stats *st = &par->stats;
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    unsigned long flags;
+
+    spin_lock_irqsave(&st->lock, flags);
+    st->frames_encoded++;
+    if (skipped)
+        st->frames_skipped++;
+    busefb_time_stat_add(&st->encode, ns);
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+/* A frame carrying writes from since went on air at frame_start */
+static void busefb_stats_latency(struct busefb_par *par, ktime_t since)
+{
+    struct busefb_stats *st = &par->stats;
+    unsigned long flags;
+
+    spin_lock_irqsave(&st->lock, flags);
+    busefb_time_stat_add(&st->latency,
+                         ktime_to_ns(ktime_sub(par->frame_start, since)));
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+static void busefb_stats_torn(struct busefb_par *par)
+{
+    struct busefb_stats *st = &par->stats;
+    unsigned long flags;
+
+    spin_lock_irqsave(&st->lock, flags);
+    st->frames_torn++;
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+static void busefb_stats_xfer(struct busefb_par *par, ktime_t end)
+{
+    struct busefb_stats *st = &par->stats;
+    unsigned long flags;
+
+    spin_lock_irqsave(&st->lock, flags);
+    busefb_time_stat_add(&st->xfer,
+                         ktime_to_ns(ktime_sub(end, par->xfer_start)));
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+static void busefb_stats_dwell(struct busefb_par *par, ktime_t end,
+                               u32 requested_us)
+{
+    struct busefb_stats *st = &par->stats;
+    s64 late = ktime_to_ns(ktime_sub(end, par->dwell_start)) -
+               (s64)requested_us * NSEC_PER_USEC;
+    unsigned long flags;
+    int i;
+
+    late = max_t(s64, late, 0);
+    for (i = 0; i < ARRAY_SIZE(busefb_dwell_hist_us); i++)
+        if (late < (s64)busefb_dwell_hist_us[i] * NSEC_PER_USEC)
+            break;
+
+    spin_lock_irqsave(&st->lock, flags);
+    busefb_time_stat_add(&st->dwell_late, late);
+    st->dwell_hist[i]++;
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+static void busefb_stats_frame(struct busefb_par *par, ktime_t now)
+{
+    struct busefb_stats *st = &par->stats;
+    unsigned long flags;
+    s64 window;
+
+    spin_lock_irqsave(&st->lock, flags);
+    st->frames_scanned++;
+    st->fps_frames++;
+    window = ktime_to_ns(ktime_sub(now, st->fps_start));
+    if (window >= NSEC_PER_SEC) {
+        st->fps = div64_u64((u64)st->fps_frames * NSEC_PER_SEC, window);
+        st->fps_frames = 0;
+        st->fps_start = now;
+    }
+    spin_unlock_irqrestore(&st->lock, flags);
+}
+
+/* ---------- Scan ---------- */
+
+/*
+ * The group cycle runs without a worker: process_next_group() raises CS
+ * and queues the group with spi_async(), the completion drops CS and
+ * arms cs_delay_timer for the dwell, and the timer re-asserts CS and
+ * queues the next group. All three run in atomic context, so the CS
+ * GPIO must not sleep. Any link of the chain that sees par->stopping
+ * ends it and signals scan_done instead of continuing.
+ */
+
+/*
+ * A frame is scanned as seq_len * bpp steps, group-major in cfg->seq
+ * order: all planes of its first group, then all planes of the second,
+ * ... Plane p is shown for DISPLAY_BRIGHTNESS_USEC << p (binary code
+ * modulation), so with 1bpp a step is simply a group. The frame
+ * boundary (swaps, governor gaps, vsync) comes once per sequence, so a
+ * sequence repeating the groups multiplexes several times per frame.
+ */
+static inline u32 busefb_steps(const struct busefb_config *cfg)
+{
+    return cfg->seq_len * cfg->bpp;
+}
+
+static inline u32 busefb_step_plane(const struct busefb_config *cfg, u32 step)
+{
+    return step % cfg->bpp;
+}
+
+/* Offset of the step's group, in group_bytes, and its message index */
+static inline u32 busefb_step_index(const struct busefb_config *cfg, u32 step)
+{
+    return busefb_step_plane(cfg, step) * GROUPS + cfg->seq[step / cfg->bpp];
+}
+
+static inline u32 busefb_step_dwell_us(const struct busefb_config *cfg,
+                                       u32 step)
+{
+    return DISPLAY_BRIGHTNESS_USEC << busefb_step_plane(cfg, step);
+}
+
+/*
+ * Latest due queue frame, dropping the ones it overtakes, or NULL.
+ * Caller holds scan_lock.
+ */
+static struct busefb_frame *busefb_queue_pop(struct busefb_par *par,
+                                             ktime_t now)
+{
+    struct busefb_frame *f = NULL;
+
+    while (par->q_count && !ktime_after(par->q_time[par->q_head], now)) {
+        f = &par->queue[par->q_head];
+        par->q_head = (par->q_head + 1) % QUEUE_FRAMES;
+        par->q_count--;
+    }
+    return f;
+}
+
+/*
+ * The loop frame to put on air once the current one has had its time,
+ * or NULL. Clears loop_playing after the last round. Caller holds
+ * scan_lock.
+ */
+static struct busefb_frame *busefb_loop_next(struct busefb_par *par,
+                                             ktime_t now)
+{
+    ktime_t due;
+
+    if (ktime_before(now, par->loop_due))
+        return NULL;
+
+    if (par->loop_pos + 1 < par->loop_n) {
+        par->loop_pos++;
+    } else if (!par->loop_loops || --par->loop_left) {
+        par->loop_pos = 0;
+    } else {
+        par->loop_playing = false;
+        return NULL;
+    }
+
+    /* Keep to the schedule, unless it fell behind (blanked, stalls) */
+    due = ktime_add_ms(par->loop_due, par->loop_ms[par->loop_pos]);
+    if (ktime_before(due, now))
+        due = ktime_add_ms(now, par->loop_ms[par->loop_pos]);
+    par->loop_due = due;
+
+    return &par->loop[par->loop_pos];
+}
+
+static bool busefb_view_moves(struct busefb_par *par)
+{
+    return READ_ONCE(par->scroll_speed) ||
+           (par->vram_bpp == 8 &&
+            READ_ONCE(par->dither) == BUSEFB_DITHER_TEMPORAL);
+}
+
+/*
+ * Start of a frame: swap in a due queued frame, the next loop frame or
+ * else the newest encoded frame, if any, and note the time for the
+ * governor.
+ */
+static void busefb_frame_boundary(struct busefb_par *par)
+{
+    struct busefb_frame *f = NULL;
+    bool swapped, loop_done = false;
+    ktime_t since = 0;
+    unsigned long flags;
+
+    par->frame_start = ktime_get();
+    busefb_stats_frame(par, par->frame_start);
+
+    spin_lock_irqsave(&par->scan_lock, flags);
+    if (par->q_count) {
+        f = busefb_queue_pop(par, par->frame_start);
+        if (f)
+            wake_up(&par->queue_wait);
+    } else if (par->loop_playing) {
+        f = busefb_loop_next(par, par->frame_start);
+        loop_done = !par->loop_playing;
+    }
+    if (!f && !par->q_count && !par->loop_playing && par->next) {
+        f = par->next;
+        par->next = NULL;
+        since = f->since;
+        f->since = 0;
+    }
+    swapped = f;
+    if (swapped) {
+        par->tx = f;
+        par->last_change = par->frame_start;
+    }
+    WRITE_ONCE(par->vsync_count, par->vsync_count + 1);
+    par->vsync_time = par->frame_start;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+
+    wake_up_all(&par->vsync_wait);
+    if (par->vsync_kn)
+        sysfs_notify_dirent(par->vsync_kn);
+    if (par->drm)
+        busefb_drm_vblank(par->drm);
+
+    if (since)
+        busefb_stats_latency(par, since);
+
+    /* Back to VRAM, master is current but may not be in a frame yet */
+    if (loop_done)
+        busefb_touch(par->info, 0, par->front_page * par->cfg.height,
+                     par->virtual_width, par->cfg.height);
+
+    /* Scrolling or temporal dither change with time, re-encode each frame */
+    if (busefb_view_moves(par))
+        queue_work(par->wq, &par->refresh_work);
+
+    trace_busefb_frame_start(par->spi, swapped);
+}
+
+/* When the governor lets the next frame start, 0 for right away */
+static ktime_t busefb_next_frame(struct busefb_par *par)
+{
+    u32 rate = READ_ONCE(par->refresh_rate);
+    u32 idle_rate = READ_ONCE(par->idle_rate);
+
+    if (idle_rate &&
+        ktime_ms_delta(ktime_get(), par->last_change) >=
+        READ_ONCE(par->idle_timeout_ms))
+        rate = rate ? min(rate, idle_rate) : idle_rate;
+
+    if (!rate)
+        return 0;
+    return ktime_add_ns(par->frame_start, NSEC_PER_SEC / rate);
+}
+
+/*
+ * End of a frame on the async/native chain. If the governor wants a gap
+ * before the next one, arm cs_delay_timer for it and return true; the
+ * timer then starts the frame. New content shows at the latest one idle
+ * period later.
+ */
+static bool busefb_frame_gap(struct busefb_par *par)
+{
+    ktime_t start = busefb_next_frame(par);
+    ktime_t now = ktime_get();
+
+    if (!ktime_before(now, start))
+        return false;
+
+    trace_busefb_frame_gap(par->spi,
+                           ktime_to_ns(ktime_sub(start, now)));
+    par->in_gap = true;
+    hrtimer_start(&par->cs_delay_timer, ktime_sub(start, now),
+                  HRTIMER_MODE_REL);
+    return true;
+}
+
+static void busefb_spi_complete(void *context);
+
+static void process_next_group(struct busefb_par *par)
+{
+    struct spi_message *m =
+        &par->tx->group_msg[busefb_step_index(&par->cfg, par->current_step)];
+    int ret;
+
+    if (READ_ONCE(par->stopping)) {
+        complete(&par->scan_done);
+        return;
+    }
+
+    /* spi_sync() from the thread engine overwrites these */
+    m->complete = busefb_spi_complete;
+    m->context = par;
+    par->cur_msg = m;
+
+    gpiod_set_value(par->cs_gpio, 1);
+    trace_busefb_step_submit(par->spi, par->current_step);
+
+    par->xfer_start = ktime_get();
+    ret = spi_async(par->spi, m);
+    if (ret) {
+        dev_err(&par->spi->dev, "scan stopped, spi_async: %d\n", ret);
+        complete(&par->scan_done);
+    }
+
+    trace_busefb_step_queued(par->spi, par->current_step, ret);
+}
+
+static void busefb_spi_complete(void *context)
+{
+    struct busefb_par *par = context;
+
+    gpiod_set_value(par->cs_gpio, 0);
+    par->dwell_start = ktime_get();
+    trace_busefb_cs_deassert(par->spi, par->current_step);
+    busefb_stats_xfer(par, par->dwell_start);
+
+    if (par->cur_msg->status)
+        dev_err_ratelimited(&par->spi->dev, "step %u transfer: %d\n",
+                            par->current_step, par->cur_msg->status);
+
+    if (READ_ONCE(par->stopping)) {
+        complete(&par->scan_done);
+        return;
+    }
+
+    hrtimer_start(&par->cs_delay_timer,
+                  us_to_ktime(busefb_step_dwell_us(&par->cfg,
+                                                   par->current_step)),
+                  HRTIMER_MODE_REL);
+}
+
+/*
+ * Native engine: the whole scan is one message. The controller drops
+ * its own CS between steps (cs_change) and holds it off for the dwell
+ * (cs_change_delay); the dwell after the last step is timed by
+ * cs_delay_timer as in the async engine. CS polarity is the controller
+ * CS's, use spi-cs-high in DT for panels latching on a falling edge.
+ */
+static void busefb_native_complete(void *context)
+{
+    struct busefb_par *par = context;
+
+    if (par->cur_msg->status)
+        dev_err_ratelimited(&par->spi->dev, "frame transfer: %d\n",
+                            par->cur_msg->status);
+
+    if (READ_ONCE(par->stopping)) {
+        complete(&par->scan_done);
+        return;
+    }
+
+    /* Dwell of the last step, the others are inside the message */
+    hrtimer_start(&par->cs_delay_timer,
+                  us_to_ktime(busefb_step_dwell_us(&par->cfg,
+                                  busefb_steps(&par->cfg) - 1)),
+                  HRTIMER_MODE_REL);
+}
+
+static void busefb_native_submit(struct busefb_par *par)
+{
+    struct spi_message *m = &par->tx->native_msg;
+    int ret;
+
+    if (READ_ONCE(par->stopping)) {
+        complete(&par->scan_done);
+        return;
+    }
+
+    m->complete = busefb_native_complete;
+    m->context = par;
+    par->cur_msg = m;
+
+    ret = spi_async(par->spi, m);
+    if (ret) {
+        dev_err(&par->spi->dev, "scan stopped, spi_async: %d\n", ret);
+        complete(&par->scan_done);
+    }
+}
+
+static void busefb_native_blank_complete(void *context)
+{
+    struct busefb_par *par = context;
+
+    if (READ_ONCE(par->stopping)) {
+        complete(&par->scan_done);
+        return;
+    }
+
+    if (!busefb_frame_gap(par)) {
+        busefb_frame_boundary(par);
+        busefb_native_submit(par);
+    }
+}
+
+/*
+ * The controller CS idles in the lit state, so after the message the
+ * last step's group would stay on through a frame gap and outshine the
+ * others. Latch a blank group first, the gap starts once it is out.
+ */
+static bool busefb_native_gap(struct busefb_par *par)
+{
+    struct spi_message *m = &par->blank_msg;
+
+    if (!ktime_before(ktime_get(), busefb_next_frame(par)))
+        return false;
+
+    par->blank_xfer = (struct spi_transfer){
+        .tx_buf = par->blank,
+        .len = par->cfg.group_bytes,
+        .speed_hz = par->speed_hz,
+    };
+    spi_message_init_with_transfers(m, &par->blank_xfer, 1);
+    m->complete = busefb_native_blank_complete;
+    m->context = par;
+    par->cur_msg = m;
+
+    if (spi_async(par->spi, m)) {
+        dev_err_ratelimited(&par->spi->dev, "blank before gap failed\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * cs_change_delay is implemented by the core's generic message loop,
+ * which every controller with a transfer_one() goes through.
+ */
+static bool busefb_native_supported(struct spi_device *spi)
+{
+    return spi->controller->transfer_one;
+}
+
+static enum hrtimer_restart cs_delay_timer_callback(struct hrtimer *timer)
+{
+    struct busefb_par *par =
+        container_of(timer, struct busefb_par, cs_delay_timer);
+
+    trace_busefb_dwell_end(par->spi, par->current_step);
+
+    if (par->in_gap) {
+        par->in_gap = false;
+        goto next_frame;
+    }
+
+    if (par->engine == BUSEFB_ENGINE_NATIVE) {
+        if (busefb_native_gap(par))
+            return HRTIMER_NORESTART;
+        goto next_frame;
+    }
+
+    gpiod_set_value(par->cs_gpio, 1);
+    trace_busefb_cs_reassert(par->spi, par->current_step);
+    busefb_stats_dwell(par, ktime_get(),
+                       busefb_step_dwell_us(&par->cfg, par->current_step));
+
+    par->current_step++;
+    if (par->current_step < busefb_steps(&par->cfg)) {
+        process_next_group(par);
+        return HRTIMER_NORESTART;
+    }
+
+    par->current_step = 0;
+    if (busefb_frame_gap(par))
+        return HRTIMER_NORESTART;
+
+next_frame:
+    busefb_frame_boundary(par);
+    if (par->engine == BUSEFB_ENGINE_NATIVE)
+        busefb_native_submit(par);
+    else
+        process_next_group(par);
+    return HRTIMER_NORESTART;
+}
+
+static void busefb_async_start(struct busefb_par *par)
+{
+    reinit_completion(&par->scan_done);
+    WRITE_ONCE(par->stopping, false);
+    par->current_step = 0;
+    par->in_gap = false;
+    par->last_change = ktime_get();
+    busefb_frame_boundary(par);
+
+    if (par->engine == BUSEFB_ENGINE_NATIVE)
+        busefb_native_submit(par);
+    else
+        process_next_group(par);
+}
+
+static void busefb_async_stop(struct busefb_par *par)
+{
+    WRITE_ONCE(par->stopping, true);
+    /* A cancelled timer means nothing else is left to end the chain */
+    if (hrtimer_cancel(&par->cs_delay_timer))
+        complete(&par->scan_done);
+    wait_for_completion(&par->scan_done);
+}
+
+/*
+ * Thread engine: the group cycle is owned by a SCHED_FIFO kthread so the
+ * dwell does not depend on workqueue or softirq latency. There is one
+ * thread per SPI controller, shared by every busefb chain on it using
+ * this engine: each chain's dwell window is used to send the other
+ * chains' steps instead of having their threads fight over the bus.
+ *
+ * Chains join and leave with the thread stopped, so the thread walks
+ * its chain list without locking. busefb_buses_lock serialises that.
+ */
+struct busefb_bus {
+    struct list_head node;
+    struct spi_controller *ctlr;
+    struct list_head chains;        /* busefb_par.bus_node */
+    struct task_struct *thread;
+    int cpu;                        /* scan_cpu of the last joiner */
+};
+
+static LIST_HEAD(busefb_buses);
+static DEFINE_MUTEX(busefb_buses_lock);
+
+/*
+ * Wait for an absolute time: sleep on an hrtimer until shortly before,
+ * then spin the last few usecs. kthread_stop() cuts the sleep short.
+ */
+static void busefb_thread_wait(ktime_t end)
+{
+    ktime_t wake = ktime_sub_us(end, THREAD_SPIN_USEC);
+
+    set_current_state(TASK_INTERRUPTIBLE);
+    if (ktime_before(ktime_get(), wake) && !kthread_should_stop())
+        schedule_hrtimeout_range(&wake, 0, HRTIMER_MODE_ABS);
+    __set_current_state(TASK_RUNNING);
+
+    while (ktime_before(ktime_get(), end) && !kthread_should_stop())
+        cpu_relax();
+}
+
+/* Bus time of one of par's steps: the last one, at least the bits */
+static s64 busefb_step_ns(struct busefb_par *par)
+{
+    u64 bits = (u64)par->cfg.group_bytes * 8 * NSEC_PER_SEC;
+
+    return max_t(s64, par->step_ns, div_u64(bits, par->speed_hz));
+}
+
+/*
+ * A chain whose dwell would end while a step of par is on the bus, and
+ * be ended late by it, by more than the thread's own slack.
+ */
+static struct busefb_par *busefb_bus_conflict(struct busefb_par *par)
+{
+    ktime_t end = ktime_add_ns(ktime_get(), busefb_step_ns(par) -
+                               THREAD_SPIN_USEC * NSEC_PER_USEC);
+    struct busefb_par *other, *first = NULL;
+
+    list_for_each_entry(other, &par->bus->chains, bus_node)
+        if (other != par && other->dwell_pending &&
+            ktime_before(other->due, end) &&
+            (!first || ktime_before(other->due, first->due)))
+            first = other;
+
+    return first;
+}
+
+/*
+ * One scheduling event of a chain, due at par->due: end the dwell of
+ * the previous step, wait out a governor gap at the end of a frame, or
+ * send the next step and start its dwell.
+ */
+static void busefb_bus_step(struct busefb_par *par)
+{
+    struct busefb_config *cfg = &par->cfg;
+    u32 s = par->current_step;
+    struct busefb_par *other;
+    struct spi_message *m;
+    ktime_t start;
+    int ret;
+
+    if (par->dwell_pending) {
+        u32 prev = (s ? s : busefb_steps(cfg)) - 1;
+
+        trace_busefb_dwell_end(par->spi, prev);
+        gpiod_set_value_cansleep(par->cs_gpio, 1);
+        trace_busefb_cs_reassert(par->spi, prev);
+        busefb_stats_dwell(par, ktime_get(), busefb_step_dwell_us(cfg, prev));
+        par->dwell_pending = false;
+
+        start = s ? 0 : busefb_next_frame(par);
+        if (ktime_before(ktime_get(), start)) {
+            trace_busefb_frame_gap(par->spi,
+                                   ktime_to_ns(ktime_sub(start, ktime_get())));
+            par->due = start;
+            return;
+        }
+
+        /* A step held back for this dwell goes first */
+        if (!list_is_singular(&par->bus->chains)) {
+            par->due = ktime_get();
+            return;
+        }
+    }
+
+    /* Wait for dwells this step would overrun, just after they end */
+    other = busefb_bus_conflict(par);
+    if (other) {
+        par->due = ktime_add_ns(other->due, 1);
+        return;
+    }
+
+    if (!s)
+        busefb_frame_boundary(par);
+
+    m = &par->tx->group_msg[busefb_step_index(cfg, s)];
+
+    gpiod_set_value_cansleep(par->cs_gpio, 1);
+    trace_busefb_step_submit(par->spi, s);
+    par->xfer_start = ktime_get();
+    ret = spi_sync(par->spi, m);
+    gpiod_set_value_cansleep(par->cs_gpio, 0);
+    par->dwell_start = ktime_get();
+    par->step_ns = ktime_to_ns(ktime_sub(par->dwell_start, par->xfer_start));
+    trace_busefb_cs_deassert(par->spi, s);
+    busefb_stats_xfer(par, par->dwell_start);
+
+    if (ret)
+        dev_err_ratelimited(&par->spi->dev, "step %u transfer: %d\n", s, ret);
+
+    par->due = ktime_add_us(par->dwell_start, busefb_step_dwell_us(cfg, s));
+    par->dwell_pending = true;
+    par->current_step = (s + 1) % busefb_steps(cfg);
+}
+
+/*
+ * Earliest due chain first, so bus time goes where a dwell ran out. A
+ * step that would run past another chain's dwell end is put off until
+ * after it (busefb_bus_conflict()), so dwells end on time and short BCM
+ * planes stay short; the bus idles rather than overrunning them.
+ */
+static int busefb_bus_thread(void *data)
+{
+    struct busefb_bus *bus = data;
+
+    while (!kthread_should_stop()) {
+        struct busefb_par *par, *first = NULL;
+
+        list_for_each_entry(par, &bus->chains, bus_node)
+            if (!first || ktime_before(par->due, first->due))
+                first = par;
+
+        busefb_thread_wait(first->due);
+        if (kthread_should_stop())
+            break;
+
+        busefb_bus_step(first);
+    }
+
+    return 0;
+}
+
+/* Caller holds busefb_buses_lock, bus has chains and no thread */
+static int busefb_bus_run(struct busefb_bus *bus)
+{
+    struct task_struct *t;
+
+    t = kthread_create(busefb_bus_thread, bus, "busefb/%s",
+                       dev_name(&bus->ctlr->dev));
+    if (IS_ERR(t))
+        return PTR_ERR(t);
+
+    sched_set_fifo(t);
+    if (bus->cpu >= 0)
+        kthread_bind(t, bus->cpu);
+
+    bus->thread = t;
+    wake_up_process(t);
+    return 0;
+}
+
+/* Caller holds busefb_buses_lock */
+static void busefb_bus_halt(struct busefb_bus *bus)
+{
+    if (bus->thread)
+        kthread_stop(bus->thread);
+    bus->thread = NULL;
+}
+
+static int busefb_thread_start(struct busefb_par *par)
+{
+    struct spi_controller *ctlr = par->spi->controller;
+    struct busefb_bus *bus;
+    int ret;
+
+    mutex_lock(&busefb_buses_lock);
+
+    list_for_each_entry(bus, &busefb_buses, node)
+        if (bus->ctlr == ctlr)
+            goto found;
+
+    bus = kzalloc(sizeof(*bus), GFP_KERNEL);
+    if (!bus) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    bus->ctlr = ctlr;
+    INIT_LIST_HEAD(&bus->chains);
+    list_add(&bus->node, &busefb_buses);
+found:
+    busefb_bus_halt(bus);
+
+    par->current_step = 0;
+    par->dwell_pending = false;
+    par->due = ktime_get();
+    par->last_change = par->due;
+    list_add_tail(&par->bus_node, &bus->chains);
+    par->bus = bus;
+    bus->cpu = par->scan_cpu;
+
+    ret = busefb_bus_run(bus);
+    if (ret) {
+        list_del(&par->bus_node);
+        par->bus = NULL;
+        if (list_empty(&bus->chains)) {
+            list_del(&bus->node);
+            kfree(bus);
+        } else if (busefb_bus_run(bus)) {
+            dev_err(&par->spi->dev, "bus scan thread lost\n");
+        }
+    }
+out:
+    mutex_unlock(&busefb_buses_lock);
+    return ret;
+}
+
+static void busefb_thread_stop(struct busefb_par *par)
+{
+    struct busefb_bus *bus = par->bus;
+
+    mutex_lock(&busefb_buses_lock);
+
+    busefb_bus_halt(bus);
+    list_del(&par->bus_node);
+    par->bus = NULL;
+    /* May have been stopped mid dwell, leave CS idle */
+    gpiod_set_value_cansleep(par->cs_gpio, 1);
+
+    if (list_empty(&bus->chains)) {
+        list_del(&bus->node);
+        kfree(bus);
+    } else if (busefb_bus_run(bus)) {
+        dev_err(&par->spi->dev, "bus scan thread lost\n");
+    }
+
+    mutex_unlock(&busefb_buses_lock);
+}
+
+static bool busefb_engine_usable(struct busefb_par *par,
+                                 enum busefb_engine e)
+{
+    switch (e) {
+    case BUSEFB_ENGINE_ASYNC:
+        /* The async chain toggles CS from atomic context */
+        return par->cs_gpio && !gpiod_cansleep(par->cs_gpio);
+    case BUSEFB_ENGINE_THREAD:
+        return par->cs_gpio;
+    case BUSEFB_ENGINE_NATIVE:
+        return busefb_native_supported(par->spi);
+    }
+    return false;
+}
+
+/* Caller holds scan_mutex. A blanked display stays parked. */
+static int busefb_scan_start(struct busefb_par *par)
+{
+    int ret = 0;
+
+    if (par->blanked)
+        return 0;
+
+    if (par->engine == BUSEFB_ENGINE_THREAD)
+        ret = busefb_thread_start(par);
+    else
+        busefb_async_start(par);
+
+    par->scanning = !ret;
+    return ret;
+}
+
+/* Caller holds scan_mutex */
+static void busefb_scan_stop(struct busefb_par *par)
+{
+    if (!par->scanning)
+        return;
+
+    if (par->engine == BUSEFB_ENGINE_THREAD)
+        busefb_thread_stop(par);
+    else
+        busefb_async_stop(par);
+
+    WRITE_ONCE(par->scanning, false);
+    /* QUEUE_FRAME waiting for a slot gives up */
+    wake_up(&par->queue_wait);
+}
+
+static int busefb_set_engine(struct busefb_par *par, enum busefb_engine e)
+{
+    int ret;
+
+    if (!busefb_engine_usable(par, e))
+        return -EINVAL;
+
+    mutex_lock(&par->scan_mutex);
+    busefb_scan_stop(par);
+    par->engine = e;
+    ret = busefb_scan_start(par);
+    mutex_unlock(&par->scan_mutex);
+
+    return ret;
+}
+
+/* ---------- Pixel map ---------- */
+
+static const struct busefb_panel *
+busefb_panel_at(const struct busefb_config *cfg, u32 x)
+{
+    u32 i = 0;
+
+    while (x >= cfg->panels[i].x + cfg->panels[i].width)
+        i++;
+    return &cfg->panels[i];
+}
+
+/*
+ * Byte offset (from the start of the frame) of register 0 of column x.
+ * The regs_per_col registers of a column follow it back to back. An
+ * upside down panel takes its columns from the other end, which also
+ * moves them to other groups.
+ */
+static u32 busefb_column_offset(const struct busefb_config *cfg, u32 x)
+{
+    const struct busefb_panel *p = busefb_panel_at(cfg, x);
+    u32 x_in = x - p->x;
+    u32 cp;
+
+    if (p->flip)
+        x_in = p->width - 1 - x_in;
+
+    /* Mirror column-pair within panel */
+    cp = (p->width / GROUPS - 1) - x_in / GROUPS;
+
+    return (x_in % GROUPS) * cfg->group_bytes + p->off + 1 +
+           cp * cfg->regs_per_col;
+}
+
+/*
+ * Byte offset and bit of pixel x,y in the SPI frame. Rows are stored
+ * bottom-up, MSB first, 8 rows per register; top-down on an upside
+ * down panel.
+ */
+static u32 busefb_pixel_offset(const struct busefb_config *cfg,
+                               u32 x, u32 y, u8 *mask)
+{
+    u32 y_rev = busefb_panel_at(cfg, x)->flip ? y : cfg->height - 1 - y;
+    u32 reg = y_rev / 8;
+    u32 bit = 7 - (y_rev % 8);
+
+    *mask = 1 << bit;
+    return busefb_column_offset(cfg, x) + reg;
+}
+
+/* Group select byte at the head of every panel in every group */
+static void busefb_write_headers(const struct busefb_config *cfg, u8 *frame)
+{
+    for (int grp = 0; grp < GROUPS; grp++)
+        for (u32 i = 0; i < cfg->num_panels; i++)
+            frame[grp * cfg->group_bytes + cfg->panels[i].off] = grp;
+}
+
+/* ---------- Encoders ---------- */
+
+/*
+ * Generic encoder: one table entry per source pixel, only lit pixels
+ * cost anything. Used when VRAM rows are not byte aligned. Always
+ * rebuilds the whole frame, bits of neighbouring pixels share bytes.
+ */
+static void busefb_encode_pixels(const struct busefb_config *cfg,
+                                 const u8 *vram, u8 *frame,
+                                 const struct busefb_rect *r)
+{
+    u32 pixels = cfg->width * cfg->height;
+
+    memset(frame, 0, cfg->frame_bytes);
+    busefb_write_headers(cfg, frame);
+
+    for (u32 idx = 0; idx < pixels; idx += 8) {
+        const struct busefb_pixel *map = &cfg->pixel_map[idx];
+        unsigned long bits = vram[idx >> 3];
+
+        while (bits) {
+            u32 b = __ffs(bits);
+
+            bits &= bits - 1;
+            if (idx + b >= pixels)
+                break;
+            frame[map[b].off] |= map[b].mask;
+        }
+    }
+}
+
+/*
+ * 8x8 bit transpose (Hacker's Delight, transpose8rS32). in[k] holds 8
+ * pixels of row k, pixel j in bit j. On return out[j] holds column j,
+ * row k in bit 7 - k, which is exactly one panel register. Kept to
+ * 32-bit words so it stays cheap on ARMv6.
+ */
+static inline void busefb_transpose8(const u8 in[8], u8 out[8])
+{
+    u32 x, y, t;
+
+    x = (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+    y = (in[4] << 24) | (in[5] << 16) | (in[6] << 8) | in[7];
+
+    t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+
+    t = (x ^ (x >> 14)) & 0x0000CCCC;  x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC;  y = y ^ t ^ (t << 14);
+
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+
+    out[7] = x >> 24;
+    out[6] = x >> 16;
+    out[5] = x >> 8;
+    out[4] = x;
+    out[3] = y >> 24;
+    out[2] = y >> 16;
+    out[1] = y >> 8;
+    out[0] = y;
+}
+
+/*
+ * Bit p of 8 packed pixels (pixel j in bits j * bpp and up of the little
+ * endian word w), gathered into bit j of the result.
+ */
+static __always_inline u8 busefb_plane_bits(u32 w, u32 bpp, u32 p)
+{
+    switch (bpp) {
+    case 2:
+        w = (w >> p) & 0x5555;
+        w = (w | w >> 1) & 0x3333;
+        w = (w | w >> 2) & 0x0F0F;
+        return w | w >> 4;
+    case 4:
+        w = (w >> p) & 0x11111111;
+        w = (w | w >> 3) & 0x03030303;
+        w = (w | w >> 6) & 0x000F000F;
+        return w | w >> 12;
+    default:
+        return w;
+    }
+}
+
+/* 8 pixels starting at pixel 8 * bx of row */
+static __always_inline u32 busefb_load8(const u8 *row, u32 bx, u32 bpp)
+{
+    const u8 *p = row + bx * bpp;
+
+    switch (bpp) {
+    case 2:
+        return p[0] | p[1] << 8;
+    case 4:
+        return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+    default:
+        return p[0];
+    }
+}
+
+/*
+ * Byte encoder: for every register row band and every 8-pixel column
+ * block, split the block into its bit-planes, transpose each 8x8 plane
+ * block and store the 8 resulting column registers whole. VRAM is read
+ * once whatever the depth. Every data byte of a block is written, so no
+ * clearing pass, and blocks outside r are simply skipped.
+ */
+static __always_inline void __busefb_encode_bytes(const struct busefb_config *cfg,
+                                                  const u8 *vram, u8 *frame,
+                                                  const struct busefb_rect *r,
+                                                  const u32 bpp)
+{
+    u32 stride = cfg->width * bpp / 8;
+    /* bands are counted from the bottom row */
+    u32 reg_lo = (cfg->height - r->y2) / 8;
+    u32 reg_hi = (cfg->height - 1 - r->y1) / 8;
+
+    for (u32 p = 0; p < bpp; p++)
+        busefb_write_headers(cfg, frame + p * cfg->frame_bytes);
+
+    for (u32 reg = reg_lo; reg <= reg_hi; reg++) {
+        /* row[k] feeds bit 7 - k of this register, NULL below row 0 */
+        const u8 *row[8];
+        u32 flip_reg = cfg->regs_per_col - 1 - reg;
+
+        for (int k = 0; k < 8; k++) {
+            int y = cfg->height - 1 - reg * 8 - k;
+
+            row[k] = y >= 0 ? vram + y * stride : NULL;
+        }
+
+        for (u32 bx = r->x1 / 8; bx < DIV_ROUND_UP(r->x2, 8); bx++) {
+            const u16 *col = &cfg->col_off[bx * 8];
+            u8 in[PLANES_MAX][8], out[8];
+
+            for (int k = 0; k < 8; k++) {
+                u32 w = row[k] ? busefb_load8(row[k], bx, bpp) : 0;
+
+                for (u32 p = 0; p < bpp; p++)
+                    in[p][k] = busefb_plane_bits(w, bpp, p);
+            }
+
+            for (u32 p = 0; p < bpp; p++) {
+                u8 *plane = frame + p * cfg->frame_bytes;
+                u32 any = 0;
+
+                for (int k = 0; k < 8; k++)
+                    any |= in[p][k];
+
+                if (any)
+                    busefb_transpose8(in[p], out);
+                else
+                    memset(out, 0, sizeof(out));
+
+                /*
+                 * Upside down panels (height a multiple of 8 there):
+                 * the band is register regs_per_col - 1 - reg, bits
+                 * reversed.
+                 */
+                for (int j = 0; j < 8; j++) {
+                    u32 c = col[j];
+
+                    if (likely(!(c & BUSEFB_COL_FLIP)))
+                        plane[c + reg] = out[j];
+                    else
+                        plane[(c & ~BUSEFB_COL_FLIP) + flip_reg] =
+                            bitrev8(out[j]);
+                }
+            }
+        }
+    }
+}
+
+static void busefb_encode_bytes_1bpp(const struct busefb_config *cfg,
+                                     const u8 *vram, u8 *frame,
+                                     const struct busefb_rect *r)
+{
+    __busefb_encode_bytes(cfg, vram, frame, r, 1);
+}
+
+static void busefb_encode_bytes_2bpp(const struct busefb_config *cfg,
+                                     const u8 *vram, u8 *frame,
+                                     const struct busefb_rect *r)
+{
+    __busefb_encode_bytes(cfg, vram, frame, r, 2);
+}
+
+static void busefb_encode_bytes_4bpp(const struct busefb_config *cfg,
+                                     const u8 *vram, u8 *frame,
+                                     const struct busefb_rect *r)
+{
+    __busefb_encode_bytes(cfg, vram, frame, r, 4);
+}
+
+/* Pick the encoder for cfg->bpp; grayscale needs byte aligned rows */
+static int busefb_select_encoder(struct busefb_config *cfg)
+{
+    if (cfg->pixel_map) {
+        if (cfg->bpp != 1)
+            return -EINVAL;
+        cfg->encode = busefb_encode_pixels;
+        return 0;
+    }
+
+    switch (cfg->bpp) {
+    case 1:
+        cfg->encode = busefb_encode_bytes_1bpp;
+        break;
+    case 2:
+        cfg->encode = busefb_encode_bytes_2bpp;
+        break;
+    case 4:
+        cfg->encode = busefb_encode_bytes_4bpp;
+        break;
+    default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* Capped so the chain width can't wrap while the panels are summed */
+static bool busefb_panel_valid(u32 width, u32 rotation)
+{
+    return width && width <= VIRTUAL_WIDTH_MAX && !(width % GROUPS) &&
+           (rotation == 0 || rotation == 180);
+}
+
+/*
+ * Lay out n panels (image order, widths already checked) within a group
+ * and size the frame. cfg->regs_per_col must be set. Leaves cfg->width
+ * to the caller, the panels add up to busefb_chain_width().
+ */
+static int busefb_init_chain(struct busefb_config *cfg, const u32 *widths,
+                             const u32 *rotation, u32 n)
+{
+    u32 x = 0, off = 0;
+
+    cfg->panels = kcalloc(n, sizeof(*cfg->panels), GFP_KERNEL);
+    if (!cfg->panels)
+        return -ENOMEM;
+
+    cfg->any_flip = false;
+    for (u32 i = 0; i < n; i++) {
+        struct busefb_panel *p = &cfg->panels[i];
+
+        p->x = x;
+        p->width = widths[i];
+        p->flip = rotation && rotation[i] == 180;
+        cfg->any_flip |= p->flip;
+        x += p->width;
+    }
+
+    /* SPI order is the reverse of image order */
+    for (int i = n - 1; i >= 0; i--) {
+        cfg->panels[i].off = off;
+        off += 1 + cfg->panels[i].width / GROUPS * cfg->regs_per_col;
+    }
+
+    cfg->num_panels = n;
+    cfg->group_bytes = off;
+    cfg->frame_bytes = GROUPS * off;
+    return 0;
+}
+
+static u32 busefb_chain_width(const struct busefb_config *cfg)
+{
+    const struct busefb_panel *last = &cfg->panels[cfg->num_panels - 1];
+
+    return last->x + last->width;
+}
+
+/*
+ * Build the lookup tables for cfg's geometry and pick the encoder. VRAM
+ * rows that start on a byte boundary go through the transpose encoder,
+ * anything else through the per-pixel table (1bpp only). So do upside
+ * down panels whose row bands don't line up with the registers.
+ */
+static int busefb_build_tables(struct busefb_config *cfg)
+{
+    if (cfg->frame_bytes >= BUSEFB_COL_FLIP)
+        return -EINVAL;
+
+    cfg->col_off = kvcalloc(cfg->width, sizeof(*cfg->col_off), GFP_KERNEL);
+    if (!cfg->col_off)
+        return -ENOMEM;
+
+    for (u32 x = 0; x < cfg->width; x++) {
+        cfg->col_off[x] = busefb_column_offset(cfg, x);
+        if (busefb_panel_at(cfg, x)->flip)
+            cfg->col_off[x] |= BUSEFB_COL_FLIP;
+    }
+
+    if (cfg->width % 8 == 0 && (!cfg->any_flip || cfg->height % 8 == 0))
+        return busefb_select_encoder(cfg);
+
+    cfg->pixel_map = kvcalloc(cfg->width * cfg->height,
+                              sizeof(*cfg->pixel_map), GFP_KERNEL);
+    if (!cfg->pixel_map) {
+        kvfree(cfg->col_off);
+        cfg->col_off = NULL;
+        return -ENOMEM;
+    }
+
+    for (u32 y = 0; y < cfg->height; y++) {
+        for (u32 x = 0; x < cfg->width; x++) {
+            struct busefb_pixel *px = &cfg->pixel_map[y * cfg->width + x];
+
+            px->off = busefb_pixel_offset(cfg, x, y, &px->mask);
+        }
+    }
+
+    return busefb_select_encoder(cfg);
+}
+
+static void busefb_free_tables(struct busefb_config *cfg)
+{
+    kvfree(cfg->pixel_map);
+    kvfree(cfg->col_off);
+    cfg->pixel_map = NULL;
+    cfg->col_off = NULL;
+}
+
+/* ---------- Frame build ---------- */
+
+/* One screen of encoder input, cfg->width pixels a row, rows packed */
+static u32 busefb_screen_bytes(const struct busefb_config *cfg)
+{
+    return DIV_ROUND_UP(cfg->width * cfg->height * cfg->bpp, 8);
+}
+
+/* First VRAM column on screen, now */
+static u32 busefb_view_x(struct busefb_par *par)
+{
+    unsigned long flags;
+    s64 x;
+    s32 rem;
+
+    spin_lock_irqsave(&par->pan_lock, flags);
+    x = par->xoffset;
+    if (par->scroll_speed)
+        x += div_s64(ktime_ms_delta(ktime_get(), par->scroll_start) *
+                     par->scroll_speed, MSEC_PER_SEC);
+    spin_unlock_irqrestore(&par->pan_lock, flags);
+
+    div_s64_rem(x, par->virtual_width, &rem);
+    return rem < 0 ? rem + par->virtual_width : rem;
+}
+
+/* n bits from bit sbit of src to bit dbit of dst, LSB first */
+static void busefb_copy_bits(u8 *dst, u32 dbit, const u8 *src, u32 sbit,
+                             u32 n)
+{
+    if (!(sbit % 8) && !(dbit % 8)) {
+        memcpy(dst + dbit / 8, src + sbit / 8, n / 8);
+        sbit += n & ~7;
+        dbit += n & ~7;
+        n %= 8;
+    }
+
+    while (n) {
+        u32 s = sbit % 8, d = dbit % 8;
+        u32 k = min3(8 - s, 8 - d, n);
+        u8 m = (1 << k) - 1;
+        u8 *p = &dst[dbit / 8];
+
+        *p = (*p & ~(m << d)) | (((src[sbit / 8] >> s) & m) << d);
+        sbit += k;
+        dbit += k;
+        n -= k;
+    }
+}
+
+static const u8 busefb_bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/* Dither phase for the frame about to be encoded, 0 unless temporal */
+static u32 busefb_dither_phase(struct busefb_par *par)
+{
+    if (par->vram_bpp != 8 ||
+        READ_ONCE(par->dither) != BUSEFB_DITHER_TEMPORAL)
+        return 0;
+    return READ_ONCE(par->vsync_count) % 64;
+}
+
+/*
+ * 8bpp image (rows stride pixels, wrapping round there) from column x
+ * to a packed 1bpp screen in out: a pixel is lit above its ordered
+ * dither threshold. phase (0..63) shifts the 8x8 Bayer matrix, stepping
+ * it every frame puts each pixel through all 64 thresholds, so the eye
+ * averages 64 levels instead of seeing the pattern. Only rows y1 to y2
+ * of out are written.
+ */
+static void busefb_dither(const struct busefb_config *cfg, const u8 *src,
+                          u32 stride, u32 x, u32 phase, u8 *out,
+                          u32 y1, u32 y2)
+{
+    u32 ox = phase % 8, oy = phase / 8;
+    u32 lo = y1 * cfg->width / 8;
+
+    memset(out + lo, 0, DIV_ROUND_UP(y2 * cfg->width, 8) - lo);
+
+    for (u32 y = y1; y < y2; y++) {
+        const u8 *row = src + y * stride;
+        const u8 *t = busefb_bayer8[(y + oy) % 8];
+        u32 p = y * cfg->width;
+        u32 sx = x;
+
+        for (u32 i = 0; i < cfg->width; i++, p++) {
+            if (row[sx] > t[(i + ox) % 8] * 4 + 2)
+                out[p / 8] |= BIT(p % 8);
+            if (++sx == stride)
+                sx = 0;
+        }
+    }
+}
+
+/*
+ * Encoder input for VRAM page from column x: the page itself when that
+ * is exactly the screen, else the window gathered out of the wider (or
+ * wrapped round) rows, or dithered from 8bpp. Dithering covers the
+ * register bands the encoder reads for r, the whole screen for the
+ * pixel encoder; a new phase or view comes with a full r. Caller holds
+ * enc_mutex.
+ */
+static const u8 *busefb_window(struct busefb_par *par, u32 page, u32 x,
+                               u32 phase, const struct busefb_rect *r)
+{
+    struct busefb_config *cfg = &par->cfg;
+    const u8 *vram = par->info->screen_base + page * par->page_bytes;
+    u32 row = par->virtual_width * cfg->bpp;
+    u32 w = cfg->width * cfg->bpp;
+    u32 first = min(cfg->width, par->virtual_width - x) * cfg->bpp;
+
+    if (par->vram_bpp == 8) {
+        u32 y1 = 0, y2 = cfg->height;
+
+        if (!cfg->pixel_map) {
+            /* bands are counted from the bottom row */
+            u32 reg_hi = (cfg->height - 1 - r->y1) / 8;
+
+            y2 -= (cfg->height - r->y2) / 8 * 8;
+            if (cfg->height > (reg_hi + 1) * 8)
+                y1 = cfg->height - (reg_hi + 1) * 8;
+        }
+        busefb_dither(cfg, vram, par->virtual_width, x, phase, par->window,
+                      y1, y2);
+        return par->window;
+    }
+
+    if (!x && par->virtual_width == cfg->width)
+        return vram;
+
+    for (u32 y = 0; y < cfg->height; y++) {
+        busefb_copy_bits(par->window, y * w, vram, y * row + x * cfg->bpp,
+                         first);
+        if (first < w)
+            busefb_copy_bits(par->window, y * w + first, vram, y * row,
+                             w - first);
+    }
+    return par->window;
+}
+
+/* One screen at the VRAM depth, what QUEUE_FRAME and LOOP_VRAM take */
+static u32 busefb_input_bytes(struct busefb_par *par)
+{
+    return DIV_ROUND_UP(par->cfg.width * par->cfg.height * par->vram_bpp, 8);
+}
+
+/*
+ * Encode such a screen into frame, whole. 8bpp goes through tmp
+ * (busefb_screen_bytes() at 1bpp) with the plain ordered dither.
+ */
+static void busefb_encode_screen(struct busefb_par *par, const u8 *src,
+                                 u8 *tmp, u8 *frame)
+{
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_rect all = { 0, 0, cfg->width, cfg->height };
+
+    if (par->vram_bpp == 8) {
+        busefb_dither(cfg, src, cfg->width, 0, 0, tmp, 0, cfg->height);
+        src = tmp;
+    }
+    cfg->encode(cfg, src, frame, &all);
+}
+
+/* VRAM damage columns in r to screen columns, for a view from x */
+static void busefb_clip_x(struct busefb_par *par, struct busefb_rect *r,
+                          u32 x)
+{
+    u32 w = par->cfg.width;
+
+    /* A wrapped view is not worth splitting */
+    if (x + w > par->virtual_width) {
+        r->x1 = 0;
+        r->x2 = w;
+        return;
+    }
+
+    r->x1 = max(r->x1, x) - x;
+    r->x2 = min(r->x2, x + w);
+    r->x2 = r->x2 > x ? r->x2 - x : 0;
+}
+
+/* The frame neither the scan nor next holds. Caller holds enc_mutex. */
+static struct busefb_frame *busefb_free_frame(struct busefb_par *par)
+{
+    struct busefb_frame *f = NULL;
+    unsigned long flags;
+
+    spin_lock_irqsave(&par->scan_lock, flags);
+    for (int i = 0; i < TX_FRAMES; i++) {
+        if (&par->frames[i] != par->tx && &par->frames[i] != par->next) {
+            f = &par->frames[i];
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+
+    return f;
+}
+
+/*
+ * Hand f to the scan, picked up at the next frame boundary. Returns
+ * true if that replaced a frame that never made it on air.
+ */
+static bool busefb_publish(struct busefb_par *par, struct busefb_frame *f)
+{
+    unsigned long flags;
+    bool skipped;
+
+    spin_lock_irqsave(&par->scan_lock, flags);
+    skipped = par->next;
+    /* The skipped frame's writes are in f too */
+    if (skipped && par->next->since)
+        f->since = par->next->since;
+    par->next = f;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+
+    return skipped;
+}
+
+static void refresh_work_func(struct work_struct *work)
+{
+    struct busefb_par *par =
+        container_of(work, struct busefb_par, refresh_work);
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_frame *f;
+    struct busefb_rect r;
+    unsigned long flags;
+    ktime_t since;
+    const u8 *front;
+    u32 page, top, x, phase;
+    ktime_t start;
+    bool skipped;
+    int gen;
+
+    mutex_lock(&par->enc_mutex);
+
+    /* Pairs with busefb_vram_begin(), a write's end queues us again */
+    gen = atomic_read(&par->vram_gen);
+    smp_rmb();
+    if (atomic_read(&par->vram_writers))
+        goto out;
+
+    /*
+     * Unchanged since the last build: keep scanning what we have. In
+     * raw mode the damage is kept for when VRAM is back on air.
+     */
+    x = busefb_view_x(par);
+    phase = busefb_dither_phase(par);
+    if ((gen == par->encoded_gen && x == par->encoded_x &&
+         phase == par->encoded_phase) || par->raw_mode)
+        goto out;
+
+    /* Only writes to the front page matter, flips damage it whole */
+    page = READ_ONCE(par->front_page);
+    spin_lock_irqsave(&par->damage_lock, flags);
+    r = par->damage;
+    since = par->damage_time;
+    par->damage = (struct busefb_rect){};
+    spin_unlock_irqrestore(&par->damage_lock, flags);
+
+    top = page * cfg->height;
+    r.y1 = max(r.y1, top) - top;
+    r.y2 = min(r.y2, top + cfg->height);
+    r.y2 = r.y2 > top ? r.y2 - top : 0;
+    busefb_clip_x(par, &r, x);
+
+    /* Panned, scrolled or dithered anew, everything moved */
+    if (x != par->encoded_x || phase != par->encoded_phase)
+        r = (struct busefb_rect){ 0, 0, cfg->width, cfg->height };
+
+    /* Its damage went into the dropped encode, redo that part too */
+    if (par->torn.x1 < par->torn.x2 && par->torn.y1 < par->torn.y2) {
+        if (r.x1 < r.x2 && r.y1 < r.y2) {
+            r.x1 = min(r.x1, par->torn.x1);
+            r.y1 = min(r.y1, par->torn.y1);
+            r.x2 = max(r.x2, par->torn.x2);
+            r.y2 = max(r.y2, par->torn.y2);
+        } else {
+            r = par->torn;
+        }
+        par->torn = (struct busefb_rect){};
+    }
+
+    par->encoded_gen = gen;
+    par->encoded_x = x;
+    par->encoded_phase = phase;
+    if (r.x1 >= r.x2 || r.y1 >= r.y2)
+        goto out;
+    if (since && !par->unpublished)
+        par->unpublished = since;
+
+    trace_busefb_refresh_start(par->spi, gen);
+
+    start = ktime_get();
+    front = busefb_window(par, page, x, phase, &r);
+    cfg->encode(cfg, front, par->master, &r);
+
+    /*
+     * Written under us: the writer's end queues the redo. Its damage
+     * may already be in r, so r is kept for that pass.
+     */
+    smp_rmb();
+    if (atomic_read(&par->vram_gen) != gen) {
+        par->torn = r;
+        busefb_stats_torn(par);
+        trace_busefb_refresh_end(par->spi, gen);
+        goto out;
+    }
+
+    f = busefb_free_frame(par);
+    memcpy(f->buf, par->master, cfg->bpp * cfg->frame_bytes);
+    f->since = par->unpublished;
+    par->unpublished = 0;
+    skipped = busefb_publish(par, f);
+
+    busefb_stats_encode(par, start, skipped);
+    trace_busefb_refresh_end(par->spi, gen);
+out:
+    mutex_unlock(&par->enc_mutex);
+}
+
+/*
+ * Restart the frame pipeline from scratch: encode the whole front page
+ * into master and scan that, or the raw frame in raw mode. Timed frames
+ * still queued stay queued. Scan stopped, caller holds enc_mutex.
+ */
+static void busefb_restart_frames(struct busefb_par *par)
+{
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_rect all = { 0, 0, cfg->width, cfg->height };
+    unsigned long flags;
+
+    spin_lock_irqsave(&par->damage_lock, flags);
+    par->damage = (struct busefb_rect){};
+    spin_unlock_irqrestore(&par->damage_lock, flags);
+
+    par->torn = (struct busefb_rect){};
+    par->encoded_gen = atomic_read(&par->vram_gen);
+    par->encoded_x = busefb_view_x(par);
+    par->encoded_phase = busefb_dither_phase(par);
+    cfg->encode(cfg, busefb_window(par, par->front_page, par->encoded_x,
+                                   par->encoded_phase, &all),
+                par->master, &all);
+    memcpy(par->frames[0].buf, par->raw_mode ? par->raw : par->master,
+           cfg->bpp * cfg->frame_bytes);
+    par->unpublished = 0;
+    par->frames[0].since = 0;
+    par->tx = &par->frames[0];
+    par->next = NULL;
+}
+
+/* busefb_restart_frames() with the timed queue dropped */
+static void busefb_reset_frames(struct busefb_par *par)
+{
+    busefb_restart_frames(par);
+    par->q_count = 0;
+    par->q_last = 0;
+    wake_up(&par->queue_wait);
+}
+
+/*
+ * Build the group and frame messages for f. With spi_optimize_message()
+ * they are validated, and prepared by the controller if it has an
+ * optimize_message hook, once here instead of on every submission. DMA
+ * mapping still happens per transfer, as the core does it.
+ */
+static int busefb_frame_prepare(struct busefb_par *par,
+                                struct busefb_frame *f)
+{
+    struct busefb_config *cfg = &par->cfg;
+    u32 msgs = GROUPS * cfg->bpp;
+    u32 steps = busefb_steps(cfg);
+
+    f->native_xfer = kcalloc(steps, sizeof(*f->native_xfer), GFP_KERNEL);
+    if (!f->native_xfer)
+        return -ENOMEM;
+
+    for (u32 i = 0; i < msgs; i++) {
+        f->group_xfer[i] = (struct spi_transfer){
+            .tx_buf = f->buf + i * cfg->group_bytes,
+            .len = cfg->group_bytes,
+            .speed_hz = par->speed_hz,
+        };
+        spi_message_init_with_transfers(&f->group_msg[i],
+                                        &f->group_xfer[i], 1);
+    }
+
+    /* The native message sends the steps in scan order */
+    for (u32 s = 0; s < steps; s++) {
+        struct spi_transfer *xfer = &f->native_xfer[s];
+
+        *xfer = f->group_xfer[busefb_step_index(cfg, s)];
+        xfer->cs_change = s < steps - 1;
+        xfer->cs_change_delay = (struct spi_delay){
+            .value = busefb_step_dwell_us(cfg, s),
+            .unit = SPI_DELAY_UNIT_USECS,
+        };
+    }
+    spi_message_init_with_transfers(&f->native_msg, f->native_xfer, steps);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+    for (u32 i = 0; i < msgs; i++) {
+        int ret = spi_optimize_message(par->spi, &f->group_msg[i]);
+
+        if (ret) {
+            while (i--)
+                spi_unoptimize_message(&f->group_msg[i]);
+            kfree(f->native_xfer);
+            f->native_xfer = NULL;
+            return ret;
+        }
+    }
+
+    /*
+     * Controllers without native CS delays may refuse this one, for
+     * every frame alike, so say it once.
+     */
+    if (busefb_native_supported(par->spi) &&
+        spi_optimize_message(par->spi, &f->native_msg))
+        dev_warn_once(&par->spi->dev,
+                      "native frame message not optimized\n");
+#endif
+
+    f->msgs = msgs;
+    f->steps = steps;
+    return 0;
+}
+
+static void busefb_frame_unprepare(struct busefb_frame *f)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+    for (u32 i = 0; i < f->msgs; i++)
+        spi_unoptimize_message(&f->group_msg[i]);
+    if (f->native_msg.pre_optimized)
+        spi_unoptimize_message(&f->native_msg);
+#endif
+    kfree(f->native_xfer);
+    f->native_xfer = NULL;
+    f->msgs = 0;
+    f->steps = 0;
+}
+
+/* Loop frames f[0..n), as left by a failed or finished setup */
+static void busefb_loop_frames_free(struct busefb_frame *f, u32 n)
+{
+    for (u32 i = 0; i < n; i++) {
+        busefb_frame_unprepare(&f[i]);
+        kfree(f[i].buf);
+    }
+    kvfree(f);
+}
+
+/* Drop the loop. Scan stopped, caller holds enc_mutex. */
+static void busefb_loop_free(struct busefb_par *par)
+{
+    if (par->loop)
+        busefb_loop_frames_free(par->loop, par->loop_n);
+    kfree(par->loop_ms);
+    par->loop = NULL;
+    par->loop_ms = NULL;
+    par->loop_n = 0;
+    par->loop_playing = false;
+}
+
+/* TX frames first, then the queue slots */
+#define BUSEFB_NR_FRAMES (TX_FRAMES + QUEUE_FRAMES)
+
+static struct busefb_frame *busefb_frame_at(struct busefb_par *par, int i)
+{
+    return i < TX_FRAMES ? &par->frames[i] : &par->queue[i - TX_FRAMES];
+}
+
+/*
+ * The buffers sized by the geometry, kept apart from par while a new
+ * geometry is set up so the old one stays intact if that fails.
+ */
+struct busefb_bufs {
+    u8 *frame[BUSEFB_NR_FRAMES];
+    u8 *q_vram;
+    u8 *window;
+    u8 *master;
+    u8 *raw;
+    u8 *blank;
+};
+
+static void busefb_free_bufs(struct busefb_bufs *b)
+{
+    for (int i = 0; i < BUSEFB_NR_FRAMES; i++)
+        kfree(b->frame[i]);
+    vfree(b->q_vram);
+    vfree(b->window);
+    vfree(b->master);
+    vfree(b->raw);
+    kfree(b->blank);
+    *b = (struct busefb_bufs){};
+}
+
+/* Frames are sized for PLANES_MAX, so a depth change only re-prepares */
+static int busefb_alloc_bufs(const struct busefb_config *cfg,
+                             struct busefb_bufs *b)
+{
+    *b = (struct busefb_bufs){};
+    b->q_vram = vmalloc(DIV_ROUND_UP(cfg->width * cfg->height *
+                                     VRAM_BPP_MAX, 8));
+    b->window = vmalloc(DIV_ROUND_UP(cfg->width * cfg->height * PLANES_MAX,
+                                     8));
+    b->master = vzalloc(PLANES_MAX * cfg->frame_bytes);
+    b->raw = vmalloc_user(PAGE_ALIGN(PLANES_MAX * cfg->frame_bytes));
+    /* Group 0's header is 0, so zeroes are a blank group */
+    b->blank = kzalloc(cfg->group_bytes, GFP_KERNEL);
+    if (!b->q_vram || !b->window || !b->master || !b->raw || !b->blank)
+        goto err;
+
+    for (int i = 0; i < BUSEFB_NR_FRAMES; i++) {
+        b->frame[i] = kzalloc(PLANES_MAX * cfg->frame_bytes, GFP_KERNEL);
+        if (!b->frame[i])
+            goto err;
+    }
+    return 0;
+err:
+    busefb_free_bufs(b);
+    return -ENOMEM;
+}
+
+/* Swap par's buffers with b's. Frames unprepared, scan stopped. */
+static void busefb_swap_bufs(struct busefb_par *par, struct busefb_bufs *b)
+{
+    for (int i = 0; i < BUSEFB_NR_FRAMES; i++)
+        swap(busefb_frame_at(par, i)->buf, b->frame[i]);
+    swap(par->q_vram, b->q_vram);
+    swap(par->window, b->window);
+    swap(par->master, b->master);
+    swap(par->raw, b->raw);
+    swap(par->blank, b->blank);
+}
+
+static void busefb_free_frames(struct busefb_par *par)
+{
+    struct busefb_bufs b = {};
+
+    busefb_loop_free(par);
+    if (par->queue) {
+        for (int i = 0; i < BUSEFB_NR_FRAMES; i++)
+            busefb_frame_unprepare(busefb_frame_at(par, i));
+        busefb_swap_bufs(par, &b);
+    }
+    busefb_free_bufs(&b);
+    kvfree(par->queue);
+    par->queue = NULL;
+}
+
+static int busefb_alloc_frames(struct busefb_par *par)
+{
+    struct busefb_bufs b;
+    int ret;
+
+    par->queue = kvcalloc(QUEUE_FRAMES, sizeof(*par->queue), GFP_KERNEL);
+    if (!par->queue)
+        return -ENOMEM;
+
+    ret = busefb_alloc_bufs(&par->cfg, &b);
+    if (ret) {
+        kvfree(par->queue);
+        par->queue = NULL;
+        return ret;
+    }
+    busefb_swap_bufs(par, &b);
+
+    for (int i = 0; i < BUSEFB_NR_FRAMES; i++) {
+        ret = busefb_frame_prepare(par, busefb_frame_at(par, i));
+        if (ret) {
+            busefb_free_frames(par);
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Rebuild the messages of every frame, loop included, after a depth or
+ * scan order change. Scan stopped, caller holds enc_mutex.
+ */
+static int busefb_prepare_frames(struct busefb_par *par)
+{
+    int ret = 0;
+
+    for (int i = 0; i < BUSEFB_NR_FRAMES && !ret; i++) {
+        busefb_frame_unprepare(busefb_frame_at(par, i));
+        ret = busefb_frame_prepare(par, busefb_frame_at(par, i));
+    }
+    for (u32 i = 0; i < par->loop_n && !ret; i++) {
+        busefb_frame_unprepare(&par->loop[i]);
+        ret = busefb_frame_prepare(par, &par->loop[i]);
+    }
+    return ret;
+}
+
+/* ---------- FB ops ---------- */
+
+/* Add x, y, w, h (virtual coordinates) to the damage, queue an encode */
+void busefb_touch(struct fb_info *info, u32 x, u32 y, u32 w, u32 h)
+{
+    struct busefb_par *par = info->par;
+    struct busefb_rect *d = &par->damage;
+    unsigned long flags;
+
+    if (!w || !h)
+        return;
+
+    spin_lock_irqsave(&par->damage_lock, flags);
+    if (d->x1 >= d->x2 || d->y1 >= d->y2) {
+        *d = (struct busefb_rect){ x, y, x + w, y + h };
+        par->damage_time = ktime_get();
+    } else {
+        d->x1 = min(d->x1, x);
+        d->y1 = min(d->y1, y);
+        d->x2 = max(d->x2, x + w);
+        d->y2 = max(d->y2, y + h);
+    }
+    spin_unlock_irqrestore(&par->damage_lock, flags);
+
+    atomic_inc(&par->vram_gen);
+    queue_work(par->wq, &par->refresh_work);
+}
+
+/*
+ * Bracket a VRAM write by write() or a drawing op, see vram_gen. The
+ * end queues an encode even if nothing was touched, one may have
+ * waited for the write.
+ */
+void busefb_vram_begin(struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+
+    atomic_inc(&par->vram_writers);
+    smp_mb__after_atomic();
+    atomic_inc(&par->vram_gen);
+    smp_mb__after_atomic();
+}
+
+void busefb_vram_end(struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+
+    smp_mb__before_atomic();
+    atomic_dec(&par->vram_writers);
+    queue_work(par->wq, &par->refresh_work);
+}
+
+/* Wait for the queued encode, its frame then goes on air next */
+void busefb_flush(struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+
+    flush_work(&par->refresh_work);
+}
+
+/* Whole rows covering VRAM bytes [start, end) */
+static void busefb_touch_bytes(struct fb_info *info, unsigned long start,
+                               unsigned long end)
+{
+    u32 line = info->fix.line_length;
+    u32 y1 = start / line;
+
+    busefb_touch(info, 0, y1, info->var.xres_virtual,
+                 DIV_ROUND_UP(end, line) - y1);
+}
+
+/*
+ * mmap clients write screen_base directly; deferred IO collects the
+ * touched pages and reports them here once per defio.delay.
+ */
+static void busefb_deferred_io(struct fb_info *info,
+                               struct list_head *pagereflist)
+{
+    struct busefb_par *par = info->par;
+    struct fb_deferred_io_pageref *pageref;
+
+    if (READ_ONCE(par->explicit_damage))
+        return;
+
+    list_for_each_entry(pageref, pagereflist, list)
+        busefb_touch_bytes(info, pageref->offset,
+                           pageref->offset + PAGE_SIZE);
+}
+
+static ssize_t busefb_write(struct fb_info *info, const char __user *buf,
+                            size_t count, loff_t *ppos)
+{
+    loff_t pos = *ppos;
+    ssize_t ret;
+
+    busefb_vram_begin(info);
+    ret = fb_sys_write(info, buf, count, ppos);
+    if (ret > 0)
+        busefb_touch_bytes(info, pos, pos + ret);
+    busefb_vram_end(info);
+    return ret;
+}
+
+/*
+ * Drawing ops work on the vmalloc'd VRAM with the sys_* helpers, not the
+ * cfb_* ones meant for I/O memory, and record their rectangle as damage
+ * so only those blocks get re-encoded.
+ */
+static void busefb_fillrect(struct fb_info *info,
+                            const struct fb_fillrect *rect)
+{
+    busefb_vram_begin(info);
+    sys_fillrect(info, rect);
+    busefb_touch(info, rect->dx, rect->dy, rect->width, rect->height);
+    busefb_vram_end(info);
+}
+
+static void busefb_copyarea(struct fb_info *info,
+                            const struct fb_copyarea *area)
+{
+    busefb_vram_begin(info);
+    sys_copyarea(info, area);
+    busefb_touch(info, area->dx, area->dy, area->width, area->height);
+    busefb_vram_end(info);
+}
+
+/*
+ * Mono image onto byte aligned 1bpp VRAM, i.e. fbcon glyphs: a plain
+ * byte copy, bit reversed since image rows are MSB first and VRAM is
+ * LSB first. sys_imageblit() would expand it pixel by pixel.
+ */
+static void busefb_blit_mono(struct fb_info *info,
+                             const struct fb_image *image)
+{
+    u32 spitch = DIV_ROUND_UP(image->width, 8);
+    u8 fg = image->fg_color & 1 ? 0xff : 0;
+    u8 bg = image->bg_color & 1 ? 0xff : 0;
+    u8 last = GENMASK((image->width - 1) % 8, 0);
+
+    for (u32 y = 0; y < image->height; y++) {
+        const u8 *src = (const u8 *)image->data + y * spitch;
+        u8 *dst = (u8 *)info->screen_base +
+                  (image->dy + y) * info->fix.line_length + image->dx / 8;
+
+        for (u32 i = 0; i < spitch; i++) {
+            u8 b = bitrev8(src[i]);
+            u8 v = (b & fg) | (~b & bg);
+            u8 m = i == spitch - 1 ? last : 0xff;
+
+            dst[i] = (dst[i] & ~m) | (v & m);
+        }
+    }
+}
+
+static void busefb_imageblit(struct fb_info *info,
+                             const struct fb_image *image)
+{
+    busefb_vram_begin(info);
+    if (image->depth == 1 && info->var.bits_per_pixel == 1 &&
+        !(image->dx % 8) && image->width)
+        busefb_blit_mono(info, image);
+    else
+        sys_imageblit(info, image);
+    busefb_touch(info, image->dx, image->dy, image->width, image->height);
+    busefb_vram_end(info);
+}
+
+/* mmap offset of the raw frame, right after VRAM */
+static unsigned long busefb_raw_offset(struct fb_info *info)
+{
+    return PAGE_ALIGN(info->fix.smem_len);
+}
+
+static int busefb_mmap(struct fb_info *info, struct vm_area_struct *vma)
+{
+    struct busefb_par *par = info->par;
+    unsigned long raw_pgoff = busefb_raw_offset(info) >> PAGE_SHIFT;
+
+    if (vma->vm_pgoff < raw_pgoff)
+        return fb_deferred_io_mmap(info, vma);
+
+    return remap_vmalloc_range(vma, par->raw, vma->vm_pgoff - raw_pgoff);
+}
+
+/* Put the raw frame on air as is, VRAM is ignored until RAW_EXIT */
+static void busefb_raw_commit(struct busefb_par *par)
+{
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_frame *f;
+
+    mutex_lock(&par->enc_mutex);
+    par->raw_mode = true;
+    f = busefb_free_frame(par);
+    memcpy(f->buf, par->raw, cfg->bpp * cfg->frame_bytes);
+    busefb_publish(par, f);
+    mutex_unlock(&par->enc_mutex);
+}
+
+static void busefb_raw_exit(struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+
+    mutex_lock(&par->enc_mutex);
+    par->raw_mode = false;
+    mutex_unlock(&par->enc_mutex);
+
+    /* master may be behind what VRAM was damaged meanwhile */
+    busefb_touch(info, 0, par->front_page * info->var.yres,
+                 info->var.xres_virtual, info->var.yres);
+}
+
+/* Room for one more, with a slot spare for the one on air */
+static bool busefb_queue_space(struct busefb_par *par)
+{
+    unsigned long flags;
+    bool space;
+
+    spin_lock_irqsave(&par->scan_lock, flags);
+    space = par->q_count < QUEUE_FRAMES - 1;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+
+    return space;
+}
+
+/*
+ * Encode one VRAM page from userspace into the next queue slot, to go
+ * on air at the first frame boundary at or after present_ns. Blocks
+ * while the queue is full.
+ */
+static int busefb_queue_frame(struct busefb_par *par,
+                              const struct busefb_timed_frame *tf)
+{
+    ktime_t t = ns_to_ktime(tf->present_ns);
+    unsigned long flags;
+    u32 slot;
+    int ret;
+
+    for (;;) {
+        if (!busefb_queue_space(par) && !READ_ONCE(par->scanning))
+            return -EAGAIN;
+
+        /* No boundary frees a slot once the scan stops */
+        ret = wait_event_interruptible(par->queue_wait,
+                                       busefb_queue_space(par) ||
+                                       !READ_ONCE(par->scanning));
+        if (ret)
+            return ret;
+
+        mutex_lock(&par->enc_mutex);
+        if (busefb_queue_space(par))
+            break;
+        mutex_unlock(&par->enc_mutex);
+    }
+
+    /* Ordered against the frames still queued, 0 goes after them */
+    spin_lock_irqsave(&par->scan_lock, flags);
+    if (!par->q_count)
+        par->q_last = 0;
+    if (!t)
+        t = par->q_last;
+    ret = ktime_before(t, par->q_last) ? -EINVAL : 0;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+    if (ret)
+        goto out;
+
+    if (copy_from_user(par->q_vram, u64_to_user_ptr(tf->data),
+                       busefb_input_bytes(par))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    /* Only the scan takes slots off, so this one stays ours */
+    spin_lock_irqsave(&par->scan_lock, flags);
+    slot = (par->q_head + par->q_count) % QUEUE_FRAMES;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+
+    busefb_encode_screen(par, par->q_vram, par->window,
+                         par->queue[slot].buf);
+
+    spin_lock_irqsave(&par->scan_lock, flags);
+    par->q_time[slot] = t;
+    par->q_count++;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+    par->q_last = t;
+out:
+    mutex_unlock(&par->enc_mutex);
+    return ret;
+}
+
+/* Drop everything not yet on air, the display goes back to VRAM */
+static void busefb_queue_flush(struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+    unsigned long flags;
+
+    mutex_lock(&par->enc_mutex);
+    spin_lock_irqsave(&par->scan_lock, flags);
+    par->q_count = 0;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+    par->q_last = 0;
+    mutex_unlock(&par->enc_mutex);
+
+    wake_up(&par->queue_wait);
+    busefb_touch(info, 0, par->front_page * info->var.yres,
+                 info->var.xres_virtual, info->var.yres);
+}
+
+/*
+ * Copy in and prepare the frames of a loop upload, encoding them first
+ * for BUSEFB_LOOP_VRAM. Caller holds scan_mutex, so the format stays.
+ */
+static struct busefb_frame *busefb_loop_load(struct busefb_par *par,
+                                             const struct busefb_loop *l)
+{
+    struct busefb_config *cfg = &par->cfg;
+    u32 size = cfg->bpp * cfg->frame_bytes;
+    bool vram = l->flags & BUSEFB_LOOP_VRAM;
+    u32 in_size = vram ? busefb_input_bytes(par) : size;
+    const u8 __user *src = u64_to_user_ptr(l->frames);
+    struct busefb_frame *frames;
+    u8 *page = NULL;
+    int ret = -ENOMEM;
+    u32 i = 0;
+
+    frames = kvcalloc(l->count, sizeof(*frames), GFP_KERNEL);
+    if (!frames)
+        return ERR_PTR(-ENOMEM);
+
+    if (vram) {
+        /* and the dither output after it */
+        page = vmalloc(in_size + busefb_screen_bytes(cfg));
+        if (!page)
+            goto err;
+    }
+
+    for (i = 0; i < l->count; i++) {
+        struct busefb_frame *f = &frames[i];
+
+        f->buf = kmalloc(size, GFP_KERNEL);
+        if (!f->buf) {
+            ret = -ENOMEM;
+            goto err;
+        }
+
+        if (copy_from_user(vram ? page : f->buf, src + i * in_size,
+                           in_size)) {
+            ret = -EFAULT;
+            goto err_buf;
+        }
+        if (vram)
+            busefb_encode_screen(par, page, page + in_size, f->buf);
+
+        ret = busefb_frame_prepare(par, f);
+        if (ret)
+            goto err_buf;
+    }
+
+    vfree(page);
+    return frames;
+
+err_buf:
+    kfree(frames[i].buf);
+err:
+    busefb_loop_frames_free(frames, i);
+    vfree(page);
+    return ERR_PTR(ret);
+}
+
+/*
+ * Replace the loop with l's frames, or just stop it for NULL, and
+ * restart the scan on it. The display shows VRAM again after that.
+ */
+static int busefb_loop_set(struct busefb_par *par,
+                           const struct busefb_loop *l)
+{
+    struct busefb_frame *frames = NULL;
+    u32 *ms = NULL;
+    int ret = 0;
+
+    if (l) {
+        if (!l->count || l->count > LOOP_FRAMES_MAX ||
+            l->flags & ~BUSEFB_LOOP_VRAM || l->reserved)
+            return -EINVAL;
+
+        ms = memdup_user(u64_to_user_ptr(l->durations),
+                         l->count * sizeof(*ms));
+        if (IS_ERR(ms))
+            return PTR_ERR(ms);
+    }
+
+    mutex_lock(&par->scan_mutex);
+    if (l) {
+        frames = busefb_loop_load(par, l);
+        if (IS_ERR(frames)) {
+            ret = PTR_ERR(frames);
+            kfree(ms);
+            goto out;
+        }
+    }
+
+    busefb_scan_stop(par);
+    mutex_lock(&par->enc_mutex);
+    busefb_loop_free(par);
+    par->raw_mode = false;
+    /* Off the old loop's frames, timed frames still go over the new one */
+    busefb_restart_frames(par);
+    if (l) {
+        par->loop = frames;
+        par->loop_ms = ms;
+        par->loop_n = l->count;
+        par->loop_loops = l->loops;
+        par->loop_left = l->loops;
+        par->loop_pos = -1;
+        par->loop_due = 0;
+        par->loop_playing = true;
+    }
+    mutex_unlock(&par->enc_mutex);
+    ret = busefb_scan_start(par);
+out:
+    mutex_unlock(&par->scan_mutex);
+    return ret;
+}
+
+/* Sleep until the next frame boundary */
+static int busefb_wait_vsync(struct busefb_par *par)
+{
+    u32 seq = READ_ONCE(par->vsync_count);
+    long ret;
+
+    ret = wait_event_interruptible_timeout(par->vsync_wait,
+                                           READ_ONCE(par->vsync_count) != seq,
+                                           msecs_to_jiffies(VSYNC_TIMEOUT_MS));
+    if (ret < 0)
+        return ret;
+    return ret ? 0 : -ETIMEDOUT;
+}
+
+static int busefb_ioctl(struct fb_info *info, unsigned int cmd,
+                        unsigned long arg)
+{
+    struct busefb_par *par = info->par;
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_timed_frame tf;
+    struct busefb_raw_info ri;
+    struct busefb_loop l;
+    struct busefb_damage d;
+    u32 crtc;
+
+    switch (cmd) {
+    case FBIO_WAITFORVSYNC:
+        if (get_user(crtc, (u32 __user *)arg))
+            return -EFAULT;
+        if (crtc)
+            return -ENODEV;
+        return busefb_wait_vsync(par);
+    case BUSEFB_IOCTL_QUEUE_FRAME:
+        if (copy_from_user(&tf, (void __user *)arg, sizeof(tf)))
+            return -EFAULT;
+        return busefb_queue_frame(par, &tf);
+    case BUSEFB_IOCTL_QUEUE_FLUSH:
+        busefb_queue_flush(info);
+        return 0;
+    case BUSEFB_IOCTL_LOOP:
+        if (copy_from_user(&l, (void __user *)arg, sizeof(l)))
+            return -EFAULT;
+        return busefb_loop_set(par, &l);
+    case BUSEFB_IOCTL_LOOP_STOP:
+        return busefb_loop_set(par, NULL);
+    case BUSEFB_IOCTL_RAW_INFO:
+        ri = (struct busefb_raw_info){
+            .offset = busefb_raw_offset(info),
+            .size = cfg->bpp * cfg->frame_bytes,
+            .group_bytes = cfg->group_bytes,
+            .groups = GROUPS,
+            .planes = cfg->bpp,
+        };
+        if (copy_to_user((void __user *)arg, &ri, sizeof(ri)))
+            return -EFAULT;
+        return 0;
+    case BUSEFB_IOCTL_RAW_COMMIT:
+        busefb_raw_commit(par);
+        return 0;
+    case BUSEFB_IOCTL_RAW_EXIT:
+        busefb_raw_exit(info);
+        return 0;
+    case BUSEFB_IOCTL_DAMAGE:
+        if (copy_from_user(&d, (void __user *)arg, sizeof(d)))
+            return -EFAULT;
+        if (d.x >= info->var.xres_virtual ||
+            d.y >= info->var.yres_virtual)
+            return -EINVAL;
+
+        WRITE_ONCE(par->explicit_damage, true);
+        busefb_touch(info, d.x, d.y,
+                     min(d.width, info->var.xres_virtual - d.x),
+                     min(d.height, info->var.yres_virtual - d.y));
+        return 0;
+    }
+    return -ENOTTY;
+}
+
+#ifdef CONFIG_COMPAT
+/* The uapi structs are the same for 32-bit callers, only arg needs it */
+static int busefb_compat_ioctl(struct fb_info *info, unsigned int cmd,
+                               unsigned long arg)
+{
+    return busefb_ioctl(info, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+
+/* Counted so the geometry only changes with VRAM unused */
+static int busefb_open(struct fb_info *info, int user)
+{
+    struct busefb_par *par = info->par;
+
+    par->users++;
+    return 0;
+}
+
+static int busefb_release(struct fb_info *info, int user)
+{
+    struct busefb_par *par = info->par;
+
+    /* Back to deferred IO damage for whoever maps us next */
+    if (!--par->users)
+        WRITE_ONCE(par->explicit_damage, false);
+    return 0;
+}
+
+/*
+ * Page flip: clients render into a back page and pan to it. Only whole
+ * pages are accepted (ypanstep == yres), the next frame build picks the
+ * new front page up. xoffset pans across a wide virtual_width to any
+ * column, and is where an auto-scroll carries on from.
+ */
+static int busefb_pan_display(struct fb_var_screeninfo *var,
+                              struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+    unsigned long flags;
+
+    if (var->xoffset + info->var.xres > info->var.xres_virtual ||
+        var->yoffset % info->var.yres)
+        return -EINVAL;
+
+    spin_lock_irqsave(&par->pan_lock, flags);
+    par->xoffset = var->xoffset;
+    par->scroll_start = ktime_get();
+    spin_unlock_irqrestore(&par->pan_lock, flags);
+
+    WRITE_ONCE(par->front_page, var->yoffset / info->var.yres);
+    busefb_touch(info, 0, var->yoffset, info->var.xres_virtual,
+                 info->var.yres);
+    return 0;
+}
+
+/*
+ * Geometry comes from DT or the height/panel_widths sysfs files (see
+ * busefb_set_geometry()), only the depth can change here: 1bpp, 2/4bpp
+ * grayscale scanned as BCM bit-planes (byte aligned widths only), or
+ * 8bpp grayscale dithered to 1bpp.
+ */
+static int busefb_check_var(struct fb_var_screeninfo *var,
+                            struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+    struct busefb_config *cfg = &par->cfg;
+    u32 bpp = var->bits_per_pixel;
+
+    if (bpp != 1 && bpp != 2 && bpp != 4 && bpp != 8)
+        return -EINVAL;
+    if ((bpp == 2 || bpp == 4) && cfg->pixel_map)
+        return -EINVAL;
+
+    var->xres = cfg->width;
+    var->yres = cfg->height;
+    var->xres_virtual = par->virtual_width;
+    var->yres_virtual = cfg->height * par->vram_pages;
+    if (var->xoffset + var->xres > var->xres_virtual)
+        var->xoffset = 0;
+    if (var->yoffset % var->yres || var->yoffset >= var->yres_virtual)
+        var->yoffset = 0;
+
+    var->grayscale = bpp > 1;
+    var->red = (struct fb_bitfield){ .offset = 0, .length = bpp };
+    var->green = var->red;
+    var->blue = var->red;
+    var->transp = (struct fb_bitfield){};
+    var->nonstd = 0;
+
+    return 0;
+}
+
+/* Sized for the deepest format busefb_check_var() accepts */
+static u32 busefb_vram_bytes(u32 virtual_width, u32 height, u32 pages)
+{
+    return DIV_ROUND_UP(virtual_width * height * VRAM_BPP_MAX, 8) * pages;
+}
+
+static void busefb_update_fix(struct busefb_par *par)
+{
+    struct fb_info *info = par->info;
+    struct busefb_config *cfg = &par->cfg;
+
+    par->page_bytes = DIV_ROUND_UP(par->virtual_width * cfg->height *
+                                   par->vram_bpp, 8);
+    info->fix.line_length = par->virtual_width * par->vram_bpp / 8;
+    info->fix.visual = par->vram_bpp == 1 ? FB_VISUAL_MONO01
+                                          : FB_VISUAL_STATIC_PSEUDOCOLOR;
+}
+
+static int busefb_apply_bpp(struct busefb_par *par, u32 bpp)
+{
+    struct busefb_config *cfg = &par->cfg;
+    int ret;
+
+    par->vram_bpp = bpp;
+    cfg->bpp = bpp == 8 ? 1 : bpp;
+    ret = busefb_select_encoder(cfg);
+    if (ret)
+        return ret;
+
+    return busefb_prepare_frames(par);
+}
+
+static int busefb_set_par(struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+    u32 old = par->vram_bpp;
+    int ret, restore = 0;
+
+    if (info->var.bits_per_pixel == old)
+        return 0;
+
+    mutex_lock(&par->scan_mutex);
+    busefb_scan_stop(par);
+    mutex_lock(&par->enc_mutex);
+
+    /* Loop frames are encoded for the old depth */
+    busefb_loop_free(par);
+    ret = busefb_apply_bpp(par, info->var.bits_per_pixel);
+    if (ret) {
+        /* check_var vetted the depth, only the messages can fail */
+        dev_err(info->device, "%ubpp: %d\n", info->var.bits_per_pixel,
+                ret);
+        info->var.bits_per_pixel = old;
+        busefb_check_var(&info->var, info);
+        restore = busefb_apply_bpp(par, old);
+    }
+
+    /* Old contents mean nothing in the new format */
+    busefb_update_fix(par);
+    memset(info->screen_base, 0, info->fix.smem_len);
+    par->front_page = 0;
+    par->xoffset = 0;
+    par->raw_mode = false;
+    busefb_reset_frames(par);
+
+    mutex_unlock(&par->enc_mutex);
+    /* Frames left without messages can't be scanned */
+    if (restore)
+        dev_err(info->device, "scan stopped, %ubpp: %d\n", old, restore);
+    else
+        busefb_scan_start(par);
+    mutex_unlock(&par->scan_mutex);
+
+    return ret;
+}
+
+/*
+ * Latch an all-off frame into every group so the panels go dark while
+ * the scan is parked. Scan stopped, caller holds enc_mutex and resets
+ * the frames afterwards.
+ */
+static void busefb_send_blank(struct busefb_par *par)
+{
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_frame *f = &par->frames[0];
+    int ret = 0;
+
+    memset(f->buf, 0, cfg->bpp * cfg->frame_bytes);
+    for (u32 p = 0; p < cfg->bpp; p++)
+        busefb_write_headers(cfg, f->buf + p * cfg->frame_bytes);
+
+    if (par->engine == BUSEFB_ENGINE_NATIVE) {
+        ret = spi_sync(par->spi, &f->native_msg);
+    } else {
+        for (u32 g = 0; g < GROUPS && !ret; g++) {
+            gpiod_set_value_cansleep(par->cs_gpio, 1);
+            ret = spi_sync(par->spi, &f->group_msg[g]);
+            gpiod_set_value_cansleep(par->cs_gpio, 0);
+        }
+        gpiod_set_value_cansleep(par->cs_gpio, 1);
+    }
+
+    if (ret)
+        dev_warn(&par->spi->dev, "blank frame: %d\n", ret);
+}
+
+/* Any blank level parks the scan; the panels draw nothing until unblank */
+int busefb_blank(int blank, struct fb_info *info)
+{
+    struct busefb_par *par = info->par;
+    bool blanked = blank != FB_BLANK_UNBLANK;
+    int ret = 0;
+
+    mutex_lock(&par->scan_mutex);
+    if (blanked == par->blanked)
+        goto out;
+
+    if (blanked) {
+        busefb_scan_stop(par);
+        mutex_lock(&par->enc_mutex);
+        busefb_send_blank(par);
+        busefb_reset_frames(par);
+        mutex_unlock(&par->enc_mutex);
+        par->blanked = true;
+    } else {
+        par->blanked = false;
+        ret = busefb_scan_start(par);
+    }
+out:
+    mutex_unlock(&par->scan_mutex);
+    return ret;
+}
+
+static const struct fb_ops busefb_ops = {
+    .owner       = THIS_MODULE,
+    .fb_read     = fb_sys_read,
+    .fb_write    = busefb_write,
+    .fb_fillrect = busefb_fillrect,
+    .fb_copyarea = busefb_copyarea,
+    .fb_imageblit = busefb_imageblit,
+    .fb_mmap     = busefb_mmap,
+    .fb_pan_display = busefb_pan_display,
+    .fb_check_var = busefb_check_var,
+    .fb_set_par  = busefb_set_par,
+    .fb_blank    = busefb_blank,
+    .fb_ioctl    = busefb_ioctl,
+#ifdef CONFIG_COMPAT
+    .fb_compat_ioctl = busefb_compat_ioctl,
+#endif
+    .fb_open     = busefb_open,
+    .fb_release  = busefb_release,
+};
+
+/* ---------- sysfs ---------- */
+
+static ssize_t engine_show(struct device *dev,
+                           struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", busefb_engine_names[par->engine]);
+}
+
+static ssize_t engine_store(struct device *dev,
+                            struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    int e, ret;
+
+    e = sysfs_match_string(busefb_engine_names, buf);
+    if (e < 0)
+        return e;
+
+    ret = busefb_set_engine(par, e);
+    return ret ?: count;
+}
+static DEVICE_ATTR_RW(engine);
+
+static ssize_t scan_cpu_show(struct device *dev,
+                             struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", par->scan_cpu);
+}
+
+/* Takes effect on the next thread start, restarts a running thread */
+static ssize_t scan_cpu_store(struct device *dev,
+                              struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    int cpu, ret;
+
+    ret = kstrtoint(buf, 0, &cpu);
+    if (ret)
+        return ret;
+    if (cpu < -1 || (cpu >= 0 && !cpu_online(cpu)))
+        return -EINVAL;
+
+    mutex_lock(&par->scan_mutex);
+    par->scan_cpu = cpu;
+    if (par->scanning && par->engine == BUSEFB_ENGINE_THREAD) {
+        busefb_scan_stop(par);
+        ret = busefb_scan_start(par);
+    }
+    mutex_unlock(&par->scan_mutex);
+
+    return ret ?: count;
+}
+static DEVICE_ATTR_RW(scan_cpu);
+
+/* Governor knobs, picked up from the next frame on */
+static ssize_t busefb_store_u32(const char *buf, size_t count, u32 *val)
+{
+    u32 v;
+    int ret;
+
+    ret = kstrtou32(buf, 0, &v);
+    if (ret)
+        return ret;
+
+    WRITE_ONCE(*val, v);
+    return count;
+}
+
+static ssize_t refresh_rate_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(par->refresh_rate));
+}
+
+static ssize_t refresh_rate_store(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return busefb_store_u32(buf, count, &par->refresh_rate);
+}
+static DEVICE_ATTR_RW(refresh_rate);
+
+static ssize_t idle_rate_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(par->idle_rate));
+}
+
+static ssize_t idle_rate_store(struct device *dev,
+                               struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return busefb_store_u32(buf, count, &par->idle_rate);
+}
+static DEVICE_ATTR_RW(idle_rate);
+
+static ssize_t idle_timeout_ms_show(struct device *dev,
+                                    struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(par->idle_timeout_ms));
+}
+
+static ssize_t idle_timeout_ms_store(struct device *dev,
+                                     struct device_attribute *attr,
+                                     const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return busefb_store_u32(buf, count, &par->idle_timeout_ms);
+}
+static DEVICE_ATTR_RW(idle_timeout_ms);
+
+static ssize_t scroll_speed_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(par->scroll_speed));
+}
+
+/* Carries on from where the view is now, 0 stops it there */
+static ssize_t scroll_speed_store(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    unsigned long flags;
+    u32 x;
+    int v, ret;
+
+    ret = kstrtoint(buf, 0, &v);
+    if (ret)
+        return ret;
+    if (abs(v) > SCROLL_SPEED_MAX)
+        return -EINVAL;
+
+    x = busefb_view_x(par);
+    spin_lock_irqsave(&par->pan_lock, flags);
+    par->xoffset = x;
+    par->scroll_start = ktime_get();
+    WRITE_ONCE(par->scroll_speed, v);
+    spin_unlock_irqrestore(&par->pan_lock, flags);
+
+    /* The scan keeps it going from the next frame on */
+    queue_work(par->wq, &par->refresh_work);
+    return count;
+}
+static DEVICE_ATTR_RW(scroll_speed);
+
+static ssize_t dither_show(struct device *dev,
+                           struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", busefb_dither_names[par->dither]);
+}
+
+static ssize_t dither_store(struct device *dev,
+                            struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    int d;
+
+    d = sysfs_match_string(busefb_dither_names, buf);
+    if (d < 0)
+        return d;
+
+    WRITE_ONCE(par->dither, d);
+    queue_work(par->wq, &par->refresh_work);
+    return count;
+}
+static DEVICE_ATTR_RW(dither);
+
+/* Every group, each as often as the others, so brightness stays even */
+static int busefb_check_seq(const u32 *seq, u32 n)
+{
+    u32 count[GROUPS] = {};
+
+    if (!n || n > SCAN_SEQ_MAX || n % GROUPS)
+        return -EINVAL;
+
+    for (u32 i = 0; i < n; i++) {
+        if (seq[i] >= GROUPS)
+            return -EINVAL;
+        count[seq[i]]++;
+    }
+    for (u32 g = 0; g < GROUPS; g++)
+        if (count[g] != n / GROUPS)
+            return -EINVAL;
+    return 0;
+}
+
+static void busefb_store_seq(struct busefb_config *cfg, const u32 *seq,
+                             u32 n)
+{
+    for (u32 i = 0; i < n; i++)
+        cfg->seq[i] = seq[i];
+    cfg->seq_len = n;
+}
+
+/* The native messages follow the sequence, so all frames are rebuilt */
+static int busefb_set_seq(struct busefb_par *par, const u32 *seq, u32 n)
+{
+    struct busefb_config *cfg = &par->cfg;
+    u32 old[SCAN_SEQ_MAX];
+    u32 old_len = cfg->seq_len;
+    int ret, restore = 0;
+
+    for (u32 i = 0; i < old_len; i++)
+        old[i] = cfg->seq[i];
+
+    mutex_lock(&par->scan_mutex);
+    busefb_scan_stop(par);
+    mutex_lock(&par->enc_mutex);
+
+    busefb_store_seq(cfg, seq, n);
+    ret = busefb_prepare_frames(par);
+    if (ret) {
+        dev_err(&par->spi->dev, "scan sequence: %d\n", ret);
+        /* A loop frame may be left without messages */
+        busefb_loop_free(par);
+        busefb_store_seq(cfg, old, old_len);
+        restore = busefb_prepare_frames(par);
+    }
+
+    mutex_unlock(&par->enc_mutex);
+    /* Frames left without messages can't be scanned */
+    if (restore)
+        dev_err(&par->spi->dev, "scan stopped, sequence: %d\n", restore);
+    else
+        busefb_scan_start(par);
+    mutex_unlock(&par->scan_mutex);
+
+    return ret;
+}
+
+static ssize_t scan_sequence_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    struct busefb_config *cfg = &par->cfg;
+    int len = 0;
+
+    mutex_lock(&par->scan_mutex);
+    for (u32 i = 0; i < cfg->seq_len; i++)
+        len += sysfs_emit_at(buf, len, "%u%c", cfg->seq[i],
+                             i + 1 < cfg->seq_len ? ' ' : '\n');
+    mutex_unlock(&par->scan_mutex);
+
+    return len;
+}
+
+/* Groups in scan order, e.g. "0 2 1 3" or "0 1 2 3 0 1 2 3" */
+static ssize_t scan_sequence_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    u32 seq[SCAN_SEQ_MAX];
+    u32 n = 0, v;
+    int len, ret;
+
+    while (sscanf(buf, "%u%n", &v, &len) == 1) {
+        if (n == SCAN_SEQ_MAX)
+            return -EINVAL;
+        seq[n++] = v;
+        buf += len;
+    }
+    if (*skip_spaces(buf))
+        return -EINVAL;
+
+    ret = busefb_check_seq(seq, n);
+    if (ret)
+        return ret;
+
+    ret = busefb_set_seq(par, seq, n);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(scan_sequence);
+
+/* Everything a geometry change replaces, swapped in and out as one */
+struct busefb_geometry {
+    struct busefb_config cfg;
+    struct busefb_bufs bufs;
+    void *vram;
+    u32 vram_len;
+    u32 virtual_width;
+};
+
+/* Scan stopped, caller holds enc_mutex, frames and loop unprepared */
+static void busefb_swap_geometry(struct busefb_par *par,
+                                 struct busefb_geometry *g)
+{
+    struct fb_info *info = par->info;
+    struct busefb_config *cfg = &par->cfg;
+    void *vram = info->screen_base;
+
+    busefb_swap_bufs(par, &g->bufs);
+    swap(*cfg, g->cfg);
+    swap(par->virtual_width, g->virtual_width);
+    swap(info->fix.smem_len, g->vram_len);
+    info->screen_base = g->vram;
+    g->vram = vram;
+
+    info->fix.xpanstep = par->virtual_width > cfg->width ? 1 : 0;
+    info->fix.ypanstep = cfg->height;
+    info->var.xres = cfg->width;
+    info->var.yres = cfg->height;
+    info->var.xres_virtual = par->virtual_width;
+    info->var.yres_virtual = cfg->height * par->vram_pages;
+    info->var.xoffset = 0;
+    info->var.yoffset = 0;
+    busefb_update_fix(par);
+}
+
+static void busefb_free_geometry(struct busefb_geometry *g)
+{
+    busefb_free_bufs(&g->bufs);
+    busefb_free_tables(&g->cfg);
+    kfree(g->cfg.panels);
+    vfree(g->vram);
+}
+
+/*
+ * Rebuild for a new chain (image order, NULL keeps the panels) and
+ * height (0 keeps it): tables, frames and VRAM, the scan restarts on a
+ * blank screen. VRAM moves, so only while nothing has the fb open or
+ * mapped, fbcon included. A wider virtual-width is kept if it still is.
+ */
+static int busefb_set_geometry(struct busefb_par *par, u32 height,
+                               const u32 *widths, const u32 *rotation,
+                               u32 n)
+{
+    struct fb_info *info = par->info;
+    struct busefb_config *cfg = &par->cfg;
+    struct busefb_geometry g = { .cfg = *cfg };
+    u32 *keep = NULL;
+    int ret, restore = 0;
+
+    /* Nothing of the new one is built yet */
+    g.cfg.panels = NULL;
+    g.cfg.col_off = NULL;
+    g.cfg.pixel_map = NULL;
+
+    if (par->drm)
+        return -EOPNOTSUPP;
+
+    lock_fb_info(info);
+    if (par->users) {
+        ret = -EBUSY;
+        goto out;
+    }
+
+    if (!widths) {
+        n = cfg->num_panels;
+        keep = kcalloc(2 * n, sizeof(*keep), GFP_KERNEL);
+        if (!keep) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        for (u32 i = 0; i < n; i++) {
+            keep[i] = cfg->panels[i].width;
+            keep[n + i] = cfg->panels[i].flip ? 180 : 0;
+        }
+        widths = keep;
+        rotation = keep + n;
+    }
+
+    g.cfg.height = height ? height : cfg->height;
+    g.cfg.regs_per_col = DIV_ROUND_UP(g.cfg.height, 8);
+    ret = busefb_init_chain(&g.cfg, widths, rotation, n);
+    if (ret)
+        goto out;
+
+    /* Whole byte rows, as in busefb_parse_panels() */
+    g.cfg.width = busefb_chain_width(&g.cfg);
+    if (g.cfg.width > VIRTUAL_WIDTH_MAX || g.cfg.width % 8) {
+        ret = -EINVAL;
+        goto out;
+    }
+    ret = busefb_build_tables(&g.cfg);
+    if (ret)
+        goto out;
+
+    g.virtual_width = par->virtual_width;
+    if (g.virtual_width == cfg->width || g.virtual_width < g.cfg.width)
+        g.virtual_width = g.cfg.width;
+    g.vram_len = busefb_vram_bytes(g.virtual_width, g.cfg.height,
+                                   par->vram_pages);
+    g.vram = vzalloc(g.vram_len);
+    if (!g.vram) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    ret = busefb_alloc_bufs(&g.cfg, &g.bufs);
+    if (ret)
+        goto out;
+
+    mutex_lock(&par->scan_mutex);
+    busefb_scan_stop(par);
+    mutex_lock(&par->enc_mutex);
+
+    /* Its page list follows smem_len */
+    fb_deferred_io_cleanup(info);
+    busefb_loop_free(par);
+    for (int i = 0; i < BUSEFB_NR_FRAMES; i++)
+        busefb_frame_unprepare(busefb_frame_at(par, i));
+
+    busefb_swap_geometry(par, &g);
+    ret = busefb_prepare_frames(par);
+    if (!ret)
+        ret = fb_deferred_io_init(info);
+    if (ret) {
+        dev_err(&par->spi->dev, "geometry: %d\n", ret);
+        busefb_swap_geometry(par, &g);
+        restore = busefb_prepare_frames(par);
+        if (!restore)
+            restore = fb_deferred_io_init(info);
+    }
+
+    par->front_page = 0;
+    par->xoffset = 0;
+    par->raw_mode = false;
+    busefb_reset_frames(par);
+
+    mutex_unlock(&par->enc_mutex);
+    if (restore)
+        dev_err(&par->spi->dev, "scan stopped, geometry: %d\n", restore);
+    else
+        busefb_scan_start(par);
+    mutex_unlock(&par->scan_mutex);
+
+    if (!ret)
+        dev_info(&par->spi->dev, "%ux%u (%u panels)\n",
+                 cfg->width, cfg->height, cfg->num_panels);
+out:
+    unlock_fb_info(info);
+    /* The old geometry after a swap, else what was built of the new */
+    busefb_free_geometry(&g);
+    kfree(keep);
+    return ret;
+}
+
+static ssize_t height_show(struct device *dev,
+                           struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(par->cfg.height));
+}
+
+static ssize_t height_store(struct device *dev,
+                            struct device_attribute *attr,
+                            const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    u32 v;
+    int ret;
+
+    ret = kstrtou32(buf, 0, &v);
+    if (ret)
+        return ret;
+    if (!v || v > HEIGHT_MAX)
+        return -EINVAL;
+
+    ret = busefb_set_geometry(par, v, NULL, NULL, 0);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(height);
+
+static ssize_t panel_widths_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    struct busefb_config *cfg = &par->cfg;
+    int len = 0;
+
+    lock_fb_info(par->info);
+    for (u32 i = 0; i < cfg->num_panels; i++)
+        len += sysfs_emit_at(buf, len, "%u%s%c", cfg->panels[i].width,
+                             cfg->panels[i].flip ? ":180" : "",
+                             i + 1 < cfg->num_panels ? ' ' : '\n');
+    unlock_fb_info(par->info);
+
+    return len;
+}
+
+/* The chain in image order, ":180" after a rotated one: "32 32:180 16" */
+static ssize_t panel_widths_store(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    u32 *widths, *rotation;
+    u32 n = 0, v;
+    int len, ret = -EINVAL;
+
+    widths = kcalloc(2 * PANELS_MAX, sizeof(*widths), GFP_KERNEL);
+    if (!widths)
+        return -ENOMEM;
+    rotation = widths + PANELS_MAX;
+
+    buf = skip_spaces(buf);
+    while (sscanf(buf, "%u%n", &v, &len) == 1) {
+        if (n == PANELS_MAX)
+            goto out;
+        widths[n] = v;
+        buf += len;
+        if (sscanf(buf, ":%u%n", &v, &len) == 1) {
+            rotation[n] = v;
+            buf += len;
+        }
+        if (!busefb_panel_valid(widths[n], rotation[n]))
+            goto out;
+        n++;
+        buf = skip_spaces(buf);
+    }
+    if (*buf || !n)
+        goto out;
+
+    ret = busefb_set_geometry(par, 0, widths, rotation, n);
+out:
+    kfree(widths);
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(panel_widths);
+
+static ssize_t spi_speed_hz_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(par->speed_hz));
+}
+
+/*
+ * Clock of the panel transfers, 0 for spi-max-frequency. Capped at the
+ * controller's maximum; what the controller makes of it is in debugfs.
+ */
+static ssize_t spi_speed_hz_store(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    struct spi_controller *ctlr = par->spi->controller;
+    u32 hz, old;
+    int ret, restore = 0;
+
+    ret = kstrtou32(buf, 0, &hz);
+    if (ret)
+        return ret;
+    if (!hz)
+        hz = par->spi->max_speed_hz;
+    if (ctlr->max_speed_hz)
+        hz = min(hz, ctlr->max_speed_hz);
+    if (hz < ctlr->min_speed_hz)
+        return -EINVAL;
+
+    mutex_lock(&par->scan_mutex);
+    busefb_scan_stop(par);
+    mutex_lock(&par->enc_mutex);
+
+    /* The frame messages carry the speed */
+    old = par->speed_hz;
+    WRITE_ONCE(par->speed_hz, hz);
+    ret = busefb_prepare_frames(par);
+    if (ret) {
+        dev_err(dev, "spi speed %u: %d\n", hz, ret);
+        busefb_loop_free(par);
+        WRITE_ONCE(par->speed_hz, old);
+        restore = busefb_prepare_frames(par);
+    }
+
+    mutex_unlock(&par->enc_mutex);
+    if (restore)
+        dev_err(dev, "scan stopped, spi speed %u: %d\n", old, restore);
+    else
+        busefb_scan_start(par);
+    mutex_unlock(&par->scan_mutex);
+
+    return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(spi_speed_hz);
+
+/*
+ * "<frame count> <CLOCK_MONOTONIC ns of its start>", notified at every
+ * frame boundary so it can be poll()ed for vsync. Added at probe rather
+ * than through dev_groups since the scan needs its kernfs node.
+ */
+static ssize_t vsync_show(struct device *dev,
+                          struct device_attribute *attr, char *buf)
+{
+    struct busefb_par *par = dev_get_drvdata(dev);
+    unsigned long flags;
+    ktime_t t;
+    u32 count;
+
+    spin_lock_irqsave(&par->scan_lock, flags);
+    count = par->vsync_count;
+    t = par->vsync_time;
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+
+    return sysfs_emit(buf, "%u %lld\n", count, ktime_to_ns(t));
+}
+static DEVICE_ATTR_RO(vsync);
+
+static void busefb_remove_vsync(struct busefb_par *par)
+{
+    if (!par->vsync_kn)
+        return;
+
+    sysfs_put(par->vsync_kn);
+    par->vsync_kn = NULL;
+    device_remove_file(&par->spi->dev, &dev_attr_vsync);
+}
+
+static struct attribute *busefb_attrs[] = {
+    &dev_attr_engine.attr,
+    &dev_attr_scan_cpu.attr,
+    &dev_attr_refresh_rate.attr,
+    &dev_attr_idle_rate.attr,
+    &dev_attr_idle_timeout_ms.attr,
+    &dev_attr_scroll_speed.attr,
+    &dev_attr_dither.attr,
+    &dev_attr_scan_sequence.attr,
+    &dev_attr_height.attr,
+    &dev_attr_panel_widths.attr,
+    &dev_attr_spi_speed_hz.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(busefb);
+
+/* ---------- debugfs ---------- */
+
+static void busefb_seq_time(struct seq_file *m, const char *name,
+                            const struct busefb_time_stat *t)
+{
+    seq_printf(m, "%s ns: min %llu avg %llu max %llu (%llu)\n", name,
+               t->min, t->count ? div64_u64(t->total, t->count) : 0,
+               t->max, t->count);
+}
+
+/* Requested clock and, if the controller reports it, the one it ran */
+static void busefb_seq_speed(struct seq_file *m, struct busefb_par *par)
+{
+    const struct spi_transfer *xfer;
+    unsigned long flags;
+    u32 effective = 0;
+
+    /* enc_mutex keeps the messages from being rebuilt under us */
+    mutex_lock(&par->enc_mutex);
+    spin_lock_irqsave(&par->scan_lock, flags);
+    if (par->tx && par->tx->steps) {
+        xfer = par->engine == BUSEFB_ENGINE_NATIVE ?
+               &par->tx->native_xfer[0] : &par->tx->group_xfer[0];
+        effective = xfer->effective_speed_hz;
+    }
+    spin_unlock_irqrestore(&par->scan_lock, flags);
+    mutex_unlock(&par->enc_mutex);
+
+    seq_printf(m, "spi speed hz: %u\n", READ_ONCE(par->speed_hz));
+    seq_printf(m, "spi effective hz: %u\n", effective);
+}
+
+static int busefb_stats_show(struct seq_file *m, void *v)
+{
+    struct busefb_par *par = m->private;
+    struct busefb_stats st;
+    unsigned long flags;
+    int i;
+
+    spin_lock_irqsave(&par->stats.lock, flags);
+    st = par->stats;
+    spin_unlock_irqrestore(&par->stats.lock, flags);
+
+    seq_printf(m, "frames encoded: %llu\n", st.frames_encoded);
+    seq_printf(m, "frames skipped: %llu\n", st.frames_skipped);
+    seq_printf(m, "frames torn: %llu\n", st.frames_torn);
+    seq_printf(m, "frames scanned: %llu\n", st.frames_scanned);
+    seq_printf(m, "scan fps: %u\n", st.fps);
+    busefb_seq_speed(m, par);
+    busefb_seq_time(m, "encode", &st.encode);
+    busefb_seq_time(m, "write to air", &st.latency);
+    busefb_seq_time(m, "spi step", &st.xfer);
+    busefb_seq_time(m, "dwell late", &st.dwell_late);
+
+    seq_puts(m, "dwell late histogram:\n");
+    for (i = 0; i < ARRAY_SIZE(busefb_dwell_hist_us); i++)
+        seq_printf(m, "  <%uus: %llu\n", busefb_dwell_hist_us[i],
+                   st.dwell_hist[i]);
+    seq_printf(m, "  >=%uus: %llu\n", busefb_dwell_hist_us[i - 1],
+               st.dwell_hist[i]);
+
+    return 0;
+}
+
+static int busefb_stats_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, busefb_stats_show, inode->i_private);
+}
+
+/* Any write clears the counters */
+static ssize_t busefb_stats_write(struct file *file, const char __user *buf,
+                                  size_t count, loff_t *ppos)
+{
+    struct seq_file *m = file->private_data;
+    struct busefb_par *par = m->private;
+
+    busefb_stats_reset(&par->stats);
+    return count;
+}
+
+static const struct file_operations busefb_stats_fops = {
+    .owner   = THIS_MODULE,
+    .open    = busefb_stats_open,
+    .read    = seq_read,
+    .write   = busefb_stats_write,
+    .llseek  = seq_lseek,
+    .release = single_release,
+};
+
+static void busefb_debugfs_init(struct busefb_par *par)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "busefb-%s", dev_name(&par->spi->dev));
+    par->debugfs = debugfs_create_dir(name, NULL);
+    debugfs_create_file("stats", 0600, par->debugfs, par,
+                        &busefb_stats_fops);
+}
+
+/* ---------- Probe ---------- */
+
+/*
+ * Chain topology, in image order: "panel-widths" and optionally
+ * "panel-rotation" (0 or 180 per panel). Without panel-widths the chain
+ * is the legacy panels x panel-width plus a tail-width panel at the far
+ * end.
+ */
+static int busefb_parse_panels(struct device *dev, struct busefb_config *cfg,
+                               u32 panels, u32 panel_width, u32 tail_width)
+{
+    int n = device_property_count_u32(dev, "panel-widths");
+    u32 *widths, *rotation;
+    u32 x;
+    int ret = 0;
+
+    if (n <= 0)
+        n = panels + (tail_width ? 1 : 0);
+    if (!n)
+        return -EINVAL;
+
+    widths = kcalloc(2 * n, sizeof(*widths), GFP_KERNEL);
+    if (!widths)
+        return -ENOMEM;
+    rotation = widths + n;
+
+    if (device_property_present(dev, "panel-widths")) {
+        ret = device_property_read_u32_array(dev, "panel-widths", widths, n);
+        if (ret)
+            goto out;
+    } else {
+        for (u32 i = 0; i < panels; i++)
+            widths[i] = panel_width;
+        if (tail_width)
+            widths[panels] = tail_width;
+    }
+
+    if (device_property_present(dev, "panel-rotation")) {
+        ret = device_property_read_u32_array(dev, "panel-rotation",
+                                             rotation, n);
+        if (ret)
+            goto out;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (!busefb_panel_valid(widths[i], rotation[i])) {
+            dev_err(dev, "panel %d: width %u rotation %u\n",
+                    i, widths[i], rotation[i]);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
+    ret = busefb_init_chain(cfg, widths, rotation, n);
+    if (ret)
+        goto out;
+    x = busefb_chain_width(cfg);
+
+    /* width can be left out when the panels are listed */
+    if (!device_property_present(dev, "width"))
+        cfg->width = x;
+
+    if (x != cfg->width) {
+        dev_err(dev, "panels are %u wide, width is %u\n", x, cfg->width);
+        ret = -EINVAL;
+    }
+
+    /* VRAM rows are whole bytes, line_length and the encoders need it */
+    if (!ret && x % 8) {
+        dev_err(dev, "chain is %u wide, not a multiple of 8\n", x);
+        ret = -EINVAL;
+    }
+out:
+    if (ret) {
+        kfree(cfg->panels);
+        cfg->panels = NULL;
+    }
+    kfree(widths);
+    return ret;
+}
+
+/* "scan-sequence", group indices in scan order, else 0 1 2 3 */
+static void busefb_parse_seq(struct device *dev, struct busefb_config *cfg)
+{
+    static const u32 linear[GROUPS] = { 0, 1, 2, 3 };
+    int n = device_property_count_u32(dev, "scan-sequence");
+    u32 seq[SCAN_SEQ_MAX];
+
+    busefb_store_seq(cfg, linear, GROUPS);
+    if (n <= 0)
+        return;
+
+    if (n > SCAN_SEQ_MAX ||
+        device_property_read_u32_array(dev, "scan-sequence", seq, n) ||
+        busefb_check_seq(seq, n)) {
+        dev_warn(dev, "bad scan-sequence, scanning 0 1 2 3\n");
+        return;
+    }
+    busefb_store_seq(cfg, seq, n);
+}
+
+/* The user facing device: /dev/fbN, or a DRM device with BUSEFB_DRM */
+static int busefb_register(struct busefb_par *par)
+{
+#ifdef BUSEFB_DRM
+    struct busefb_drm *bd;
+
+    bd = busefb_drm_register(par->info, par->cfg.width, par->cfg.height);
+    if (IS_ERR(bd))
+        return PTR_ERR(bd);
+    WRITE_ONCE(par->drm, bd);
+    return 0;
+#else
+    struct fb_info *info = par->info;
+    int ret;
+
+    ret = fb_deferred_io_init(info);
+    if (ret)
+        return ret;
+
+    ret = register_framebuffer(info);
+    if (ret)
+        fb_deferred_io_cleanup(info);
+    return ret;
+#endif
+}
+
+static void busefb_unregister(struct busefb_par *par)
+{
+#ifdef BUSEFB_DRM
+    busefb_drm_unregister(par->drm);
+#else
+    unregister_framebuffer(par->info);
+    fb_deferred_io_cleanup(par->info);
+#endif
+}
+
+static int busefb_probe(struct spi_device *spi)
+{
+    struct fb_info *info;
+    struct busefb_par *par;
+    struct busefb_config *cfg;
+    int ret;
+
+    u32 width = 128, height = 19, panels = 4;
+    u32 panel_width = 32, tail_width = 0;
+    u32 vram_pages = VRAM_PAGES_DEFAULT;
+    const char *engine;
+    const char *dither;
+    u32 scan_cpu;
+
+    info = framebuffer_alloc(sizeof(*par), &spi->dev);
+    if (!info)
+        return -ENOMEM;
+
+    par = info->par;
+    par->spi = spi;
+    par->info = info;
+    cfg = &par->cfg;
+
+    device_property_read_u32(&spi->dev, "width", &width);
+    device_property_read_u32(&spi->dev, "height", &height);
+    device_property_read_u32(&spi->dev, "panels", &panels);
+    device_property_read_u32(&spi->dev, "panel-width", &panel_width);
+    device_property_read_u32(&spi->dev, "tail-width", &tail_width);
+    device_property_read_u32(&spi->dev, "vram-pages", &vram_pages);
+
+    if (!tail_width && width > panels * panel_width)
+        tail_width = width - panels * panel_width;
+
+    cfg->width = width;
+    cfg->height = height;
+    cfg->regs_per_col = DIV_ROUND_UP(height, 8);
+    cfg->bpp = 1;
+    par->vram_bpp = 1;
+    par->speed_hz = spi->max_speed_hz;
+#ifdef BUSEFB_DRM
+    /* XRGB8888 planes come in as gray, dithered like fbdev 8bpp */
+    par->vram_bpp = 8;
+#endif
+    busefb_parse_seq(&spi->dev, cfg);
+
+    ret = busefb_parse_panels(&spi->dev, cfg, panels, panel_width,
+                              tail_width);
+    if (ret)
+        goto err_release;
+
+    ret = busefb_build_tables(cfg);
+    if (ret)
+        goto err_free_panels;
+
+    ret = busefb_alloc_frames(par);
+    if (ret)
+        goto err_free_map;
+
+    /* Without a CS GPIO only the native engine can drive the panels */
+    par->cs_gpio = devm_gpiod_get_optional(&spi->dev, "cs", GPIOD_OUT_HIGH);
+    if (IS_ERR(par->cs_gpio)) {
+        ret = PTR_ERR(par->cs_gpio);
+        goto err_free_fb;
+    }
+
+    par->engine = BUSEFB_ENGINE_ASYNC;
+    if (!device_property_read_string(&spi->dev, "scan-engine", &engine)) {
+        ret = match_string(busefb_engine_names,
+                           ARRAY_SIZE(busefb_engine_names), engine);
+        if (ret >= 0)
+            par->engine = ret;
+    }
+
+    par->scan_cpu = -1;
+    if (!device_property_read_u32(&spi->dev, "scan-cpu", &scan_cpu) &&
+        scan_cpu < nr_cpu_ids)
+        par->scan_cpu = scan_cpu;
+
+    par->idle_timeout_ms = IDLE_TIMEOUT_MS_DEFAULT;
+    device_property_read_u32(&spi->dev, "refresh-rate", &par->refresh_rate);
+    device_property_read_u32(&spi->dev, "idle-rate", &par->idle_rate);
+    device_property_read_u32(&spi->dev, "idle-timeout-ms",
+                             &par->idle_timeout_ms);
+
+    /* Fall back to the GPIO engines the controller or CS can't do */
+    if (!busefb_engine_usable(par, par->engine))
+        par->engine = BUSEFB_ENGINE_ASYNC;
+    if (!busefb_engine_usable(par, par->engine))
+        par->engine = BUSEFB_ENGINE_THREAD;
+    if (!busefb_engine_usable(par, par->engine))
+        par->engine = BUSEFB_ENGINE_NATIVE;
+    if (!busefb_engine_usable(par, par->engine)) {
+        dev_err(&spi->dev, "no cs gpio and no native CS support\n");
+        ret = -ENODEV;
+        goto err_free_fb;
+    }
+
+    par->vram_pages = clamp_t(u32, vram_pages, 1, VRAM_PAGES_MAX);
+
+    if (!device_property_read_string(&spi->dev, "dither", &dither)) {
+        ret = match_string(busefb_dither_names,
+                           ARRAY_SIZE(busefb_dither_names), dither);
+        if (ret >= 0)
+            par->dither = ret;
+    }
+
+    /* Wider rows to pan/scroll across, byte aligned */
+    par->virtual_width = cfg->width;
+    device_property_read_u32(&spi->dev, "virtual-width", &par->virtual_width);
+    if (par->virtual_width < cfg->width ||
+        par->virtual_width > VIRTUAL_WIDTH_MAX ||
+        (par->virtual_width != cfg->width && par->virtual_width % 8)) {
+        dev_err(&spi->dev, "virtual-width %u\n", par->virtual_width);
+        ret = -EINVAL;
+        goto err_free_fb;
+    }
+
+    info->fix = (struct fb_fix_screeninfo){
+        .id = "busefb",
+        .type = FB_TYPE_PACKED_PIXELS,
+        .xpanstep = par->virtual_width > cfg->width ? 1 : 0,
+        .ypanstep = cfg->height,
+        .smem_len = busefb_vram_bytes(par->virtual_width, cfg->height,
+                                      par->vram_pages),
+    };
+
+    info->var = (struct fb_var_screeninfo){
+        .bits_per_pixel = par->vram_bpp,
+        .xres = cfg->width,
+        .yres = cfg->height,
+        .xres_virtual = par->virtual_width,
+        .yres_virtual = cfg->height * par->vram_pages,
+    };
+
+    info->fbops = &busefb_ops;
+    info->flags = FBINFO_VIRTFB;
+    busefb_update_fix(par);
+
+    info->screen_base = vzalloc(info->fix.smem_len);
+    if (!info->screen_base) {
+        ret = -ENOMEM;
+        goto err_free_fb;
+    }
+
+    par->wq = create_singlethread_workqueue("busefb_wq");
+    if (!par->wq) {
+        ret = -ENOMEM;
+        goto err_free_screen;
+    }
+
+    INIT_WORK(&par->refresh_work, refresh_work_func);
+    spin_lock_init(&par->scan_lock);
+    init_completion(&par->scan_done);
+    init_waitqueue_head(&par->queue_wait);
+    init_waitqueue_head(&par->vsync_wait);
+    mutex_init(&par->scan_mutex);
+    mutex_init(&par->enc_mutex);
+    spin_lock_init(&par->stats.lock);
+    spin_lock_init(&par->damage_lock);
+    spin_lock_init(&par->pan_lock);
+    busefb_stats_reset(&par->stats);
+
+    hrtimer_init(&par->cs_delay_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    par->cs_delay_timer.function = cs_delay_timer_callback;
+
+    par->defio.delay = HZ / 60;
+    par->defio.deferred_io = busefb_deferred_io;
+    info->fbdefio = &par->defio;
+
+    /* First frame synchronously, later ones from refresh_work */
+    busefb_reset_frames(par);
+
+    ret = busefb_register(par);
+    if (ret)
+        goto err_destroy_wq;
+
+    spi_set_drvdata(spi, par);
+
+    /* Optional, FBIO_WAITFORVSYNC works without it */
+    if (!device_create_file(&spi->dev, &dev_attr_vsync))
+        par->vsync_kn = sysfs_get_dirent(spi->dev.kobj.sd, "vsync");
+
+    mutex_lock(&par->scan_mutex);
+    ret = busefb_scan_start(par);
+    mutex_unlock(&par->scan_mutex);
+    if (ret)
+        goto err_vsync;
+
+    busefb_debugfs_init(par);
+
+    dev_info(&spi->dev,
+         "busefb: %ux%u (%u panels)\n",
+         cfg->width, cfg->height, cfg->num_panels);
+
+    return 0;
+
+err_vsync:
+    busefb_remove_vsync(par);
+    busefb_unregister(par);
+err_destroy_wq:
+    destroy_workqueue(par->wq);
+err_free_screen:
+    vfree(info->screen_base);
+err_free_fb:
+    busefb_free_frames(par);
+err_free_map:
+    busefb_free_tables(cfg);
+err_free_panels:
+    kfree(cfg->panels);
+err_release:
+    framebuffer_release(info);
+    return ret;
+}
+
+static void busefb_remove(struct spi_device *spi)
+{
+    struct busefb_par *par = spi_get_drvdata(spi);
+
+    debugfs_remove_recursive(par->debugfs);
+    busefb_unregister(par);
+
+    mutex_lock(&par->scan_mutex);
+    busefb_scan_stop(par);
+    mutex_unlock(&par->scan_mutex);
+
+    /* The scan notifies it, so only once that is gone */
+    busefb_remove_vsync(par);
+    destroy_workqueue(par->wq);
+    gpiod_set_value_cansleep(par->cs_gpio, 1);
+    vfree(par->info->screen_base);
+    busefb_free_frames(par);
+    busefb_free_tables(&par->cfg);
+    kfree(par->cfg.panels);
+    framebuffer_release(par->info);
+}
+
+static const struct of_device_id busefb_of_match[] = {
+    { .compatible = "buse,busefb" },
+    { }
+};
+MODULE_DEVICE_TABLE(of, busefb_of_match);
+
+static struct spi_driver busefb_driver = {
+    .driver = {
+        .name = "busefb",
+        .of_match_table = busefb_of_match,
+        .dev_groups = busefb_groups,
+    },
+    .probe  = busefb_probe,
+    .remove = busefb_remove,
+};
+
+module_spi_driver(busefb_driver);
+
+#ifdef BUSEFB_KUNIT_TEST
+#include "busefb_test.c"
+#endif
+
+MODULE_AUTHOR("You");
+MODULE_DESCRIPTION("Buse SPI framebuffer driver");
+MODULE_LICENSE("GPL");
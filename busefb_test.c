@@ -0,0 +1,519 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the busefb frame encoder. Built into the module with
+ * "make KUNIT=1" (kernel with CONFIG_KUNIT), and included from
+ * busefb_main.c so the static encoder is in reach. The suite runs when
+ * the module loads, results go to dmesg and
+ * /sys/kernel/debug/kunit/busefb-encoder.
+ *
+ * The golden cases pin single pixels of the two busefb-overlay.dts
+ * chains to the frame bytes test/debug_buffer.py prints. The others
+ * compare every encoder against busefb_ref_encode(), a plain per pixel
+ * transcription of the mapping, over random VRAM and a range of chains.
+ * busefb_test_bench is the scoreboard: ns per full frame encode.
+ */
+
+#include <kunit/test.h>
+#include <linux/prandom.h>
+
+#define BUSEFB_TEST_SEED 0x62757365
+#define BUSEFB_TEST_ROUNDS 20
+#define BUSEFB_BENCH_FRAMES 2000
+
+struct busefb_test_geom {
+    const char *name;
+    u32 height;
+    /* panel widths (and rotations, or NULL), repeated repeat times */
+    const u32 *widths;
+    const u32 *rotation;
+    u32 n;
+    u32 repeat;
+};
+
+static const u32 busefb_w_4x32[] = { 32, 32, 32, 32 };
+static const u32 busefb_w_4x32_16[] = { 32, 32, 32, 32, 16 };
+static const u32 busefb_r_mixed5[] = { 0, 180, 0, 0, 180 };
+static const u32 busefb_w_4x32_4[] = { 32, 32, 32, 32, 4 };
+static const u32 busefb_w_32[] = { 32 };
+static const u32 busefb_w_mixed[] = { 32, 16, 32, 12, 4 };
+static const u32 busefb_r_mixed[] = { 0, 180, 180, 0, 180 };
+
+static const struct busefb_test_geom busefb_test_geoms[] = {
+    { "128x19", 19, busefb_w_4x32, NULL, 4, 1 },
+    { "144x19", 19, busefb_w_4x32_16, NULL, 5, 1 },
+    { "144x19 flipped", 19, busefb_w_4x32_16, busefb_r_mixed5, 5, 1 },
+    { "144x16 flipped", 16, busefb_w_4x32_16, busefb_r_mixed5, 5, 1 },
+    { "132x19", 19, busefb_w_4x32_4, NULL, 5, 1 },
+    { "512x19", 19, busefb_w_32, NULL, 1, 16 },
+    { "768x24 mixed", 24, busefb_w_mixed, busefb_r_mixed, 5, 8 },
+    { "768x7 mixed", 7, busefb_w_mixed, busefb_r_mixed, 5, 8 },
+};
+
+static void busefb_geom_desc(const struct busefb_test_geom *g, char *desc)
+{
+    strscpy(desc, g->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(busefb_geom, busefb_test_geoms, busefb_geom_desc);
+
+static void busefb_test_free(void *data)
+{
+    struct busefb_config *cfg = data;
+
+    busefb_free_tables(cfg);
+    kfree(cfg->panels);
+}
+
+/* Build cfg for g the way probe does, NULL if bpp needs the byte encoder */
+static struct busefb_config *busefb_test_config(struct kunit *test,
+                                                const struct busefb_test_geom *g,
+                                                u32 bpp)
+{
+    u32 n = g->n * g->repeat;
+    struct busefb_config *cfg;
+    u32 *widths, *rotation;
+
+    cfg = kunit_kzalloc(test, sizeof(*cfg), GFP_KERNEL);
+    widths = kunit_kcalloc(test, n, sizeof(*widths), GFP_KERNEL);
+    rotation = kunit_kcalloc(test, n, sizeof(*rotation), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, cfg);
+    KUNIT_ASSERT_NOT_NULL(test, widths);
+    KUNIT_ASSERT_NOT_NULL(test, rotation);
+
+    for (u32 i = 0; i < n; i++) {
+        widths[i] = g->widths[i % g->n];
+        rotation[i] = g->rotation ? g->rotation[i % g->n] : 0;
+    }
+
+    cfg->height = g->height;
+    cfg->regs_per_col = DIV_ROUND_UP(g->height, 8);
+    cfg->bpp = 1;
+    KUNIT_ASSERT_EQ(test, busefb_init_chain(cfg, widths, rotation, n), 0);
+    cfg->width = busefb_chain_width(cfg);
+
+    if (busefb_build_tables(cfg)) {
+        kfree(cfg->panels);
+        KUNIT_FAIL(test, "no tables for %s", g->name);
+        return NULL;
+    }
+    KUNIT_ASSERT_EQ(test, kunit_add_action_or_reset(test, busefb_test_free,
+                                                    cfg), 0);
+
+    if (bpp != 1) {
+        cfg->bpp = bpp;
+        if (busefb_select_encoder(cfg))
+            return NULL;
+    }
+    return cfg;
+}
+
+static u8 busefb_get_pixel(const struct busefb_config *cfg, const u8 *vram,
+                           u32 x, u32 y)
+{
+    u32 bit = (y * cfg->width + x) * cfg->bpp;
+
+    return (vram[bit / 8] >> (bit % 8)) & ((1 << cfg->bpp) - 1);
+}
+
+static void busefb_set_pixel(const struct busefb_config *cfg, u8 *vram,
+                             u32 x, u32 y, u8 v)
+{
+    u32 bit = (y * cfg->width + x) * cfg->bpp;
+    u8 mask = ((1 << cfg->bpp) - 1) << (bit % 8);
+
+    vram[bit / 8] = (vram[bit / 8] & ~mask) | ((v << (bit % 8)) & mask);
+}
+
+/*
+ * The whole mapping, one pixel at a time and without any table. Panel
+ * i in image order sits after panels n-1..i+1 in every group, a panel
+ * carries a group select byte and then its column pairs, rightmost
+ * first, each regs_per_col registers of 8 rows from the bottom, MSB
+ * first. A 180 degree panel is the same with x and y turned around.
+ */
+static void busefb_ref_encode(const struct busefb_config *cfg,
+                              const u8 *vram, u8 *frame)
+{
+    memset(frame, 0, cfg->bpp * cfg->frame_bytes);
+
+    for (u32 p = 0; p < cfg->bpp; p++) {
+        u8 *plane = frame + p * cfg->frame_bytes;
+
+        for (u32 grp = 0; grp < GROUPS; grp++) {
+            u32 off = grp * cfg->group_bytes;
+
+            for (int i = cfg->num_panels - 1; i >= 0; i--) {
+                plane[off] = grp;
+                off += 1 + cfg->panels[i].width / GROUPS * cfg->regs_per_col;
+            }
+        }
+    }
+
+    for (u32 y = 0; y < cfg->height; y++) {
+        for (u32 x = 0; x < cfg->width; x++) {
+            u8 v = busefb_get_pixel(cfg, vram, x, y);
+            const struct busefb_panel *panel = cfg->panels;
+            u32 px, py, row, off;
+
+            if (!v)
+                continue;
+
+            while (x >= panel->x + panel->width)
+                panel++;
+            px = x - panel->x;
+            py = y;
+            if (panel->flip) {
+                px = panel->width - 1 - px;
+                py = cfg->height - 1 - y;
+            }
+            row = cfg->height - 1 - py;
+
+            off = (px % GROUPS) * cfg->group_bytes + panel->off + 1 +
+                  (panel->width / GROUPS - 1 - px / GROUPS) * cfg->regs_per_col +
+                  row / 8;
+
+            for (u32 p = 0; p < cfg->bpp; p++)
+                if (v & BIT(p))
+                    frame[p * cfg->frame_bytes + off] |= BIT(7 - row % 8);
+        }
+    }
+}
+
+static void busefb_encode_full(const struct busefb_config *cfg,
+                               const u8 *vram, u8 *frame)
+{
+    struct busefb_rect r = { 0, 0, cfg->width, cfg->height };
+
+    cfg->encode(cfg, vram, frame, &r);
+}
+
+struct busefb_test_golden {
+    u32 x, y;
+    u32 off;
+    u8 mask;
+};
+
+/* 4x32, 19 rows: 25 bytes a panel, panel 0 last in the group */
+static const struct busefb_test_golden busefb_golden_128[] = {
+    { 0, 0, 99, 0x20 },
+    { 1, 0, 199, 0x20 },
+    { 4, 0, 96, 0x20 },
+    { 0, 10, 98, 0x80 },
+    { 31, 18, 376, 0x80 },
+    { 32, 0, 74, 0x20 },
+    { 70, 8, 245, 0x20 },
+    { 127, 18, 301, 0x80 },
+};
+
+/* 4x32 + 16: the 13 byte half panel goes first */
+static const struct busefb_test_golden busefb_golden_144[] = {
+    { 0, 0, 112, 0x20 },
+    { 1, 0, 225, 0x20 },
+    { 4, 0, 109, 0x20 },
+    { 0, 10, 111, 0x80 },
+    { 31, 18, 428, 0x80 },
+    { 32, 0, 87, 0x20 },
+    { 70, 8, 284, 0x20 },
+    { 127, 18, 353, 0x80 },
+    { 128, 0, 12, 0x20 },
+    { 131, 9, 350, 0x40 },
+    { 143, 18, 340, 0x80 },
+};
+
+static void busefb_check_golden(struct kunit *test,
+                                const struct busefb_test_geom *g,
+                                u32 group_bytes,
+                                const struct busefb_test_golden *gold,
+                                size_t count)
+{
+    struct busefb_config *cfg = busefb_test_config(test, g, 1);
+    u8 *vram, *frame;
+
+    KUNIT_ASSERT_NOT_NULL(test, cfg);
+    KUNIT_EXPECT_EQ(test, cfg->group_bytes, group_bytes);
+    KUNIT_EXPECT_EQ(test, cfg->frame_bytes, GROUPS * group_bytes);
+
+    vram = kunit_kzalloc(test, busefb_screen_bytes(cfg), GFP_KERNEL);
+    frame = kunit_kzalloc(test, cfg->frame_bytes, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, vram);
+    KUNIT_ASSERT_NOT_NULL(test, frame);
+
+    for (size_t i = 0; i < count; i++) {
+        busefb_set_pixel(cfg, vram, gold[i].x, gold[i].y, 1);
+        busefb_encode_full(cfg, vram, frame);
+        busefb_set_pixel(cfg, vram, gold[i].x, gold[i].y, 0);
+
+        for (u32 off = 0; off < cfg->frame_bytes; off++) {
+            u32 g_off = off % cfg->group_bytes;
+            bool header = false;
+            u8 want = 0;
+
+            for (u32 p = 0; p < cfg->num_panels; p++)
+                header |= g_off == cfg->panels[p].off;
+
+            if (header)
+                want = off / cfg->group_bytes;
+            else if (off == gold[i].off)
+                want = gold[i].mask;
+
+            KUNIT_EXPECT_EQ_MSG(test, frame[off], want,
+                                "pixel %u,%u byte %u", gold[i].x,
+                                gold[i].y, off);
+        }
+    }
+}
+
+static void busefb_test_golden_128(struct kunit *test)
+{
+    busefb_check_golden(test, &busefb_test_geoms[0], 100, busefb_golden_128,
+                        ARRAY_SIZE(busefb_golden_128));
+}
+
+static void busefb_test_golden_144(struct kunit *test)
+{
+    busefb_check_golden(test, &busefb_test_geoms[1], 113, busefb_golden_144,
+                        ARRAY_SIZE(busefb_golden_144));
+}
+
+/* Random VRAM, then all lit, at depth bpp, against the reference */
+static void busefb_check_random(struct kunit *test, u32 bpp)
+{
+    const struct busefb_test_geom *g = test->param_value;
+    struct busefb_config *cfg = busefb_test_config(test, g, bpp);
+    struct rnd_state rnd;
+    u8 *vram, *frame, *ref;
+    u32 len;
+
+    if (!cfg)
+        kunit_skip(test, "%s has no %u bpp encoder", g->name, bpp);
+
+    len = cfg->bpp * cfg->frame_bytes;
+    vram = kunit_kzalloc(test, busefb_screen_bytes(cfg), GFP_KERNEL);
+    frame = kunit_kzalloc(test, len, GFP_KERNEL);
+    ref = kunit_kzalloc(test, len, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, vram);
+    KUNIT_ASSERT_NOT_NULL(test, frame);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+
+    prandom_seed_state(&rnd, BUSEFB_TEST_SEED);
+    for (int i = 0; i <= BUSEFB_TEST_ROUNDS; i++) {
+        if (i < BUSEFB_TEST_ROUNDS)
+            prandom_bytes_state(&rnd, vram, busefb_screen_bytes(cfg));
+        else
+            memset(vram, 0xff, busefb_screen_bytes(cfg));
+
+        busefb_encode_full(cfg, vram, frame);
+        busefb_ref_encode(cfg, vram, ref);
+        KUNIT_ASSERT_MEMEQ_MSG(test, frame, ref, len, "round %d (%s)", i,
+                               cfg->pixel_map ? "pixels" : "bytes");
+    }
+}
+
+static void busefb_test_encode(struct kunit *test)
+{
+    busefb_check_random(test, 1);
+}
+
+static void busefb_test_encode_2bpp(struct kunit *test)
+{
+    busefb_check_random(test, 2);
+}
+
+static void busefb_test_encode_4bpp(struct kunit *test)
+{
+    busefb_check_random(test, 4);
+}
+
+/*
+ * Damage: change VRAM inside a random rectangle only, re-encode just
+ * that over the previous frame and expect a full encode's result.
+ */
+static void busefb_test_partial(struct kunit *test)
+{
+    const struct busefb_test_geom *g = test->param_value;
+    struct busefb_config *cfg = busefb_test_config(test, g, 1);
+    struct rnd_state rnd;
+    u8 *vram, *frame, *ref;
+
+    KUNIT_ASSERT_NOT_NULL(test, cfg);
+    vram = kunit_kzalloc(test, busefb_screen_bytes(cfg), GFP_KERNEL);
+    frame = kunit_kzalloc(test, cfg->frame_bytes, GFP_KERNEL);
+    ref = kunit_kzalloc(test, cfg->frame_bytes, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, vram);
+    KUNIT_ASSERT_NOT_NULL(test, frame);
+    KUNIT_ASSERT_NOT_NULL(test, ref);
+
+    prandom_seed_state(&rnd, BUSEFB_TEST_SEED);
+    prandom_bytes_state(&rnd, vram, busefb_screen_bytes(cfg));
+    busefb_encode_full(cfg, vram, frame);
+
+    for (int i = 0; i < BUSEFB_TEST_ROUNDS * 5; i++) {
+        struct busefb_rect r;
+
+        r.x1 = prandom_u32_state(&rnd) % cfg->width;
+        r.y1 = prandom_u32_state(&rnd) % cfg->height;
+        r.x2 = r.x1 + 1 + prandom_u32_state(&rnd) % (cfg->width - r.x1);
+        r.y2 = r.y1 + 1 + prandom_u32_state(&rnd) % (cfg->height - r.y1);
+
+        for (u32 y = r.y1; y < r.y2; y++)
+            for (u32 x = r.x1; x < r.x2; x++)
+                busefb_set_pixel(cfg, vram, x, y,
+                                 prandom_u32_state(&rnd) & 1);
+
+        cfg->encode(cfg, vram, frame, &r);
+        busefb_ref_encode(cfg, vram, ref);
+        KUNIT_ASSERT_MEMEQ_MSG(test, frame, ref, cfg->frame_bytes,
+                               "rect %u,%u-%u,%u", r.x1, r.y1, r.x2, r.y2);
+    }
+}
+
+/* Full frame encode cost, half the pixels lit */
+static void busefb_test_bench(struct kunit *test)
+{
+    const struct busefb_test_geom *g = test->param_value;
+    struct busefb_config *cfg = busefb_test_config(test, g, 1);
+    struct rnd_state rnd;
+    u8 *vram, *frame;
+    ktime_t start;
+    u64 ns;
+
+    KUNIT_ASSERT_NOT_NULL(test, cfg);
+    vram = kunit_kzalloc(test, busefb_screen_bytes(cfg), GFP_KERNEL);
+    frame = kunit_kzalloc(test, cfg->frame_bytes, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, vram);
+    KUNIT_ASSERT_NOT_NULL(test, frame);
+
+    prandom_seed_state(&rnd, BUSEFB_TEST_SEED);
+    prandom_bytes_state(&rnd, vram, busefb_screen_bytes(cfg));
+    busefb_encode_full(cfg, vram, frame);
+
+    start = ktime_get();
+    for (int i = 0; i < BUSEFB_BENCH_FRAMES; i++)
+        busefb_encode_full(cfg, vram, frame);
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    kunit_info(test, "%s (%s): %llu ns/frame\n", g->name,
+               cfg->pixel_map ? "pixels" : "bytes",
+               div_u64(ns, BUSEFB_BENCH_FRAMES));
+}
+
+/* Window gathering for panning: any bit offset and length */
+static void busefb_test_copy_bits(struct kunit *test)
+{
+    struct rnd_state rnd;
+    u8 src[64], dst[64], want[64];
+
+    prandom_seed_state(&rnd, BUSEFB_TEST_SEED);
+    for (int i = 0; i < 1000; i++) {
+        u32 sbit = prandom_u32_state(&rnd) % 256;
+        u32 dbit = prandom_u32_state(&rnd) % 256;
+        u32 n = prandom_u32_state(&rnd) % (256 - max(sbit, dbit));
+
+        prandom_bytes_state(&rnd, src, sizeof(src));
+        prandom_bytes_state(&rnd, dst, sizeof(dst));
+        memcpy(want, dst, sizeof(dst));
+        for (u32 b = 0; b < n; b++) {
+            u32 d = dbit + b, sb = sbit + b;
+
+            want[d / 8] &= ~BIT(d % 8);
+            want[d / 8] |= ((src[sb / 8] >> (sb % 8)) & 1) << (d % 8);
+        }
+
+        busefb_copy_bits(dst, dbit, src, sbit, n);
+        KUNIT_ASSERT_MEMEQ_MSG(test, dst, want, sizeof(dst),
+                               "%u bits from %u to %u", n, sbit, dbit);
+    }
+}
+
+/*
+ * 8bpp dither: over the 64 temporal phases every pixel of a flat gray
+ * is lit as often as the level asks, whatever its position.
+ */
+static void busefb_test_dither(struct kunit *test)
+{
+    static const u8 levels[] = { 0, 1, 3, 64, 128, 200, 254, 255 };
+    struct busefb_config *cfg = busefb_test_config(test,
+                                                   &busefb_test_geoms[1], 1);
+    u32 pixels, *lit;
+    u8 *src, *out;
+
+    KUNIT_ASSERT_NOT_NULL(test, cfg);
+    pixels = cfg->width * cfg->height;
+    src = kunit_kzalloc(test, pixels, GFP_KERNEL);
+    out = kunit_kzalloc(test, busefb_screen_bytes(cfg), GFP_KERNEL);
+    lit = kunit_kcalloc(test, pixels, sizeof(*lit), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, src);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+    KUNIT_ASSERT_NOT_NULL(test, lit);
+
+    for (size_t l = 0; l < ARRAY_SIZE(levels); l++) {
+        u32 want = 0;
+
+        /* thresholds are 4 * k + 2 for k = 0..63 */
+        for (u32 k = 0; k < 64; k++)
+            want += levels[l] > 4 * k + 2;
+
+        memset(src, levels[l], pixels);
+        memset(lit, 0, pixels * sizeof(*lit));
+        for (u32 phase = 0; phase < 64; phase++) {
+            busefb_dither(cfg, src, cfg->width, 0, phase, out, 0, cfg->height);
+            for (u32 p = 0; p < pixels; p++)
+                lit[p] += (out[p / 8] >> (p % 8)) & 1;
+        }
+
+        for (u32 p = 0; p < pixels; p++)
+            KUNIT_ASSERT_EQ_MSG(test, lit[p], want, "level %u pixel %u",
+                                levels[l], p);
+    }
+}
+
+/* Scan sequences: even ones only, and the steps follow them plane by plane */
+static void busefb_test_scan_seq(struct kunit *test)
+{
+    static const u32 interleaved[] = { 0, 2, 1, 3, 1, 3, 0, 2 };
+    static const u32 uneven[] = { 0, 1, 2, 3, 0, 1, 2, 0 };
+    static const u32 missing[] = { 0, 1, 2, 2 };
+    static const u32 bad_group[] = { 0, 1, 2, 4 };
+    struct busefb_config cfg = { .bpp = 2 };
+    u32 seen[PLANES_MAX * GROUPS] = {};
+
+    KUNIT_EXPECT_EQ(test, busefb_check_seq(interleaved, 8), 0);
+    KUNIT_EXPECT_EQ(test, busefb_check_seq(interleaved, 6), -EINVAL);
+    KUNIT_EXPECT_EQ(test, busefb_check_seq(uneven, 8), -EINVAL);
+    KUNIT_EXPECT_EQ(test, busefb_check_seq(missing, 4), -EINVAL);
+    KUNIT_EXPECT_EQ(test, busefb_check_seq(bad_group, 4), -EINVAL);
+
+    busefb_store_seq(&cfg, interleaved, ARRAY_SIZE(interleaved));
+    KUNIT_ASSERT_EQ(test, busefb_steps(&cfg), 16u);
+    for (u32 s = 0; s < busefb_steps(&cfg); s++) {
+        u32 i = busefb_step_index(&cfg, s);
+
+        KUNIT_EXPECT_EQ(test, i % GROUPS, interleaved[s / 2]);
+        KUNIT_EXPECT_EQ(test, i / GROUPS, s % 2);
+        seen[i]++;
+    }
+    for (u32 i = 0; i < 2 * GROUPS; i++)
+        KUNIT_EXPECT_EQ(test, seen[i], 2u);
+}
+
+static struct kunit_case busefb_test_cases[] = {
+    KUNIT_CASE(busefb_test_golden_128),
+    KUNIT_CASE(busefb_test_golden_144),
+    KUNIT_CASE_PARAM(busefb_test_encode, busefb_geom_gen_params),
+    KUNIT_CASE_PARAM(busefb_test_encode_2bpp, busefb_geom_gen_params),
+    KUNIT_CASE_PARAM(busefb_test_encode_4bpp, busefb_geom_gen_params),
+    KUNIT_CASE_PARAM(busefb_test_partial, busefb_geom_gen_params),
+    KUNIT_CASE(busefb_test_copy_bits),
+    KUNIT_CASE(busefb_test_dither),
+    KUNIT_CASE(busefb_test_scan_seq),
+    KUNIT_CASE_PARAM_ATTR(busefb_test_bench, busefb_geom_gen_params,
+                          { .speed = KUNIT_SPEED_SLOW }),
+    { }
+};
+
+static struct kunit_suite busefb_test_suite = {
+    .name = "busefb-encoder",
+    .test_cases = busefb_test_cases,
+};
+
+kunit_test_suite(busefb_test_suite);
@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for the busefb refresh pipeline: frame encode, the
+ * per-step SPI submission, the CS edges around the dwell and frame
+ * boundaries. Events carry the SPI device, spiB.C as in its name, so
+ * chains tell apart in both the fbdev and the DRM build.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM busefb
+
+#if !defined(_BUSEFB_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BUSEFB_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/spi/spi.h>
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+#define BUSEFB_TRACE_CS(spi) spi_get_chipselect(spi, 0)
+#else
+#define BUSEFB_TRACE_CS(spi) ((spi)->chip_select)
+#endif
+
+DECLARE_EVENT_CLASS(busefb_refresh,
+    TP_PROTO(struct spi_device *spi, int gen),
+    TP_ARGS(spi, gen),
+
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, cs)
+        __field(int, gen)
+    ),
+
+    TP_fast_assign(
+        __entry->bus = spi->controller->bus_num;
+        __entry->cs = BUSEFB_TRACE_CS(spi);
+        __entry->gen = gen;
+    ),
+
+    TP_printk("spi%d.%d gen=%d", __entry->bus, __entry->cs, __entry->gen)
+);
+
+/* refresh_work_func(), gen is the VRAM generation being encoded */
+DEFINE_EVENT(busefb_refresh, busefb_refresh_start,
+    TP_PROTO(struct spi_device *spi, int gen),
+    TP_ARGS(spi, gen)
+);
+
+DEFINE_EVENT(busefb_refresh, busefb_refresh_end,
+    TP_PROTO(struct spi_device *spi, int gen),
+    TP_ARGS(spi, gen)
+);
+
+DECLARE_EVENT_CLASS(busefb_step,
+    TP_PROTO(struct spi_device *spi, u32 step),
+    TP_ARGS(spi, step),
+
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, cs)
+        __field(u32, step)
+    ),
+
+    TP_fast_assign(
+        __entry->bus = spi->controller->bus_num;
+        __entry->cs = BUSEFB_TRACE_CS(spi);
+        __entry->step = step;
+    ),
+
+    TP_printk("spi%d.%d step=%u", __entry->bus, __entry->cs, __entry->step)
+);
+
+/* CS asserted, step about to be queued (process_next_group() entry) */
+DEFINE_EVENT(busefb_step, busefb_step_submit,
+    TP_PROTO(struct spi_device *spi, u32 step),
+    TP_ARGS(spi, step)
+);
+
+/* Transfer done, CS dropped: dwell starts */
+DEFINE_EVENT(busefb_step, busefb_cs_deassert,
+    TP_PROTO(struct spi_device *spi, u32 step),
+    TP_ARGS(spi, step)
+);
+
+/* cs_delay_timer_callback() fired, or the scan thread's dwell ended */
+DEFINE_EVENT(busefb_step, busefb_dwell_end,
+    TP_PROTO(struct spi_device *spi, u32 step),
+    TP_ARGS(spi, step)
+);
+
+/* CS raised again after the dwell */
+DEFINE_EVENT(busefb_step, busefb_cs_reassert,
+    TP_PROTO(struct spi_device *spi, u32 step),
+    TP_ARGS(spi, step)
+);
+
+/* process_next_group() exit, ret from spi_async() */
+TRACE_EVENT(busefb_step_queued,
+    TP_PROTO(struct spi_device *spi, u32 step, int ret),
+    TP_ARGS(spi, step, ret),
+
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, cs)
+        __field(u32, step)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->bus = spi->controller->bus_num;
+        __entry->cs = BUSEFB_TRACE_CS(spi);
+        __entry->step = step;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("spi%d.%d step=%u ret=%d", __entry->bus, __entry->cs,
+              __entry->step, __entry->ret)
+);
+
+/* Frame boundary, swapped: a newly encoded frame went on air */
+TRACE_EVENT(busefb_frame_start,
+    TP_PROTO(struct spi_device *spi, bool swapped),
+    TP_ARGS(spi, swapped),
+
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, cs)
+        __field(bool, swapped)
+    ),
+
+    TP_fast_assign(
+        __entry->bus = spi->controller->bus_num;
+        __entry->cs = BUSEFB_TRACE_CS(spi);
+        __entry->swapped = swapped;
+    ),
+
+    TP_printk("spi%d.%d swapped=%d", __entry->bus, __entry->cs,
+              __entry->swapped)
+);
+
+/* Governor pause before the next frame */
+TRACE_EVENT(busefb_frame_gap,
+    TP_PROTO(struct spi_device *spi, s64 gap_ns),
+    TP_ARGS(spi, gap_ns),
+
+    TP_STRUCT__entry(
+        __field(int, bus)
+        __field(int, cs)
+        __field(s64, gap_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->bus = spi->controller->bus_num;
+        __entry->cs = BUSEFB_TRACE_CS(spi);
+        __entry->gap_ns = gap_ns;
+    ),
+
+    TP_printk("spi%d.%d gap=%lldns", __entry->bus, __entry->cs, __entry->gap_ns)
+);
+
+#endif /* _BUSEFB_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE busefb_trace
+#include <trace/define_trace.h>
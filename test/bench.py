@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""Benchmark - drive the framebuffer at a set rate, report driver timing
+
+Each run draws a moving bar for --seconds through one path:
+
+  write   write() of the whole screen
+  mmap    mapped copy plus BUSEFB_IOCTL_DAMAGE
+  vsync   FBIO_WAITFORVSYNC, then write()
+  flip    mapped back page, then FBIOPAN_DISPLAY
+
+The debugfs statistics are cleared before and read after every run, so
+root and a mounted debugfs are needed. One JSON object per run goes to
+stdout (or --out), for comparing driver versions:
+
+  sudo ./bench.py write mmap --fps 30,60,0 --seconds 5 > before.jsonl
+
+fps 0 means as fast as the path goes. "write_to_air_ns" is the driver's
+time from the first VRAM write of a frame to the frame boundary that put
+it on air, i.e. to its first SPI byte. "dropped" are frames drawn but
+never scanned: coalesced into one encode or replaced before the scan
+got to them.
+"""
+
+import argparse
+import fcntl
+import glob
+import json
+import mmap
+import os
+import platform
+import re
+import struct
+import sys
+import time
+
+FBIOGET_VSCREENINFO = 0x4600
+FBIOPAN_DISPLAY = 0x4606
+FBIO_WAITFORVSYNC = 0x40044620
+BUSEFB_IOCTL_DAMAGE = 0x40104201
+
+MODES = ('write', 'mmap', 'vsync', 'flip')
+
+class Fb:
+    def __init__(self, path):
+        self.file = open(path, 'r+b', buffering=0)
+        self.var = bytearray(160)
+        fcntl.ioctl(self.file, FBIOGET_VSCREENINFO, self.var)
+        (self.xres, self.yres, self.xres_virtual,
+         self.yres_virtual) = struct.unpack_from('IIII', self.var, 0)
+        self.bpp = struct.unpack_from('I', self.var, 24)[0]
+        self.line = self.xres_virtual * self.bpp // 8
+        self.page = self.line * self.yres
+        self.pages = self.yres_virtual // self.yres
+        self.map = None
+
+    def mapped(self):
+        if self.map is None:
+            self.map = mmap.mmap(self.file.fileno(), self.page * self.pages)
+        return self.map
+
+    def pan(self, page):
+        struct.pack_into('II', self.var, 16, 0, page * self.yres)
+        fcntl.ioctl(self.file, FBIOPAN_DISPLAY, self.var)
+
+    def wait_vsync(self):
+        fcntl.ioctl(self.file, FBIO_WAITFORVSYNC, struct.pack('I', 0))
+
+    def damage(self):
+        fcntl.ioctl(self.file, BUSEFB_IOCTL_DAMAGE,
+                    struct.pack('IIII', 0, 0, self.xres, self.yres))
+
+def bar_page(fb, n):
+    """A page with an 8 pixel bar at column n * 4, any depth"""
+    row = bytearray(fb.line)
+    px = fb.bpp
+    for x in range(n * 4 % fb.xres, n * 4 % fb.xres + 8):
+        bit = (x % fb.xres) * px
+        for b in range(px):
+            row[(bit + b) // 8] |= 1 << ((bit + b) % 8)
+    return bytes(row) * fb.yres
+
+def find_stats(path):
+    if path:
+        return path
+    found = sorted(glob.glob('/sys/kernel/debug/busefb-*/stats'))
+    if not found:
+        sys.exit('no busefb stats in debugfs (mounted? root?)')
+    return found[0]
+
+TIME_RE = re.compile(r'^(.+) ns: min (\d+) avg (\d+) max (\d+) \((\d+)\)$')
+
+def read_stats(path):
+    stats = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            m = TIME_RE.match(line)
+            if m:
+                key = m.group(1).replace(' ', '_') + '_ns'
+                stats[key] = dict(zip(('min', 'avg', 'max', 'count'),
+                                      map(int, m.groups()[1:])))
+            elif ': ' in line:
+                key, value = line.split(': ', 1)
+                if value.isdigit():
+                    stats[key.replace(' ', '_')] = int(value)
+    return stats
+
+def reset_stats(path):
+    with open(path, 'w') as f:
+        f.write('\n')
+
+def run(fb, mode, fps, seconds, stats_path):
+    pages = [bar_page(fb, n) for n in range(fb.xres // 4)]
+    period = 1 / fps if fps else 0
+    calls = []
+
+    if mode == 'flip' and fb.pages < 2:
+        sys.exit('flip needs vram-pages >= 2')
+    front = 0
+    if mode == 'flip':
+        fb.pan(0)
+    if mode == 'vsync':
+        fb.wait_vsync()
+
+    reset_stats(stats_path)
+    start = time.monotonic()
+    due = start
+    n = 0
+    while time.monotonic() - start < seconds:
+        data = pages[n % len(pages)]
+        t = time.monotonic()
+        if mode == 'write' or mode == 'vsync':
+            if mode == 'vsync':
+                fb.wait_vsync()
+                t = time.monotonic()
+            os.pwrite(fb.file.fileno(), data, 0)
+        elif mode == 'mmap':
+            fb.mapped()[0:fb.page] = data
+            fb.damage()
+        else:
+            back = 1 - front
+            fb.mapped()[back * fb.page:(back + 1) * fb.page] = data
+            fb.pan(back)
+            front = back
+        calls.append(time.monotonic() - t)
+        n += 1
+
+        if period:
+            due += period
+            delay = due - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+            else:
+                due = time.monotonic()
+    elapsed = time.monotonic() - start
+    # Let the last frame reach the wire before reading the counters
+    time.sleep(0.1)
+
+    stats = read_stats(stats_path)
+    shown = stats.get('frames_encoded', 0) - stats.get('frames_skipped', 0)
+    calls.sort()
+    return {
+        'mode': mode,
+        'fps_requested': fps,
+        'seconds': round(elapsed, 3),
+        'frames_drawn': n,
+        'fps_achieved': round(n / elapsed, 2),
+        'dropped': max(n - shown, 0),
+        'call_us': {
+            'min': round(calls[0] * 1e6, 1),
+            'p50': round(calls[len(calls) // 2] * 1e6, 1),
+            'p99': round(calls[len(calls) * 99 // 100] * 1e6, 1),
+            'max': round(calls[-1] * 1e6, 1),
+        } if calls else None,
+        'driver': stats,
+    }
+
+def driver_version():
+    try:
+        with open('/sys/module/busefb/srcversion') as f:
+            return f.read().strip()
+    except OSError:
+        return None
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    ap.add_argument('modes', nargs='*', default=['write'], choices=MODES)
+    ap.add_argument('--fps', default='60',
+                    help='comma separated rates, 0 = flat out (60)')
+    ap.add_argument('--seconds', type=float, default=5)
+    ap.add_argument('--device', default='/dev/fb0')
+    ap.add_argument('--stats', help='debugfs stats file (first busefb)')
+    ap.add_argument('--out', help='append the results here, not stdout')
+    args = ap.parse_args()
+
+    fb = Fb(args.device)
+    stats_path = find_stats(args.stats)
+    out = open(args.out, 'a') if args.out else sys.stdout
+    common = {
+        'kernel': platform.release(),
+        'srcversion': driver_version(),
+        'geometry': f'{fb.xres}x{fb.yres}@{fb.bpp}',
+    }
+
+    for mode in args.modes:
+        for fps in (int(f) for f in args.fps.split(',')):
+            result = dict(common, **run(fb, mode, fps, args.seconds,
+                                        stats_path))
+            print(json.dumps(result), file=out, flush=True)
+            print(f"{mode} @{fps or 'max'}: {result['fps_achieved']} fps, "
+                  f"{result['dropped']} dropped, write to air avg "
+                  f"{result['driver'].get('write_to_air_ns', {}).get('avg')} "
+                  f"ns", file=sys.stderr)
+
+if __name__ == '__main__':
+    main()
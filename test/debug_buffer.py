@@ -1,47 +1,60 @@
 #!/usr/bin/env python3
-"""Debug: show what buffer values SHOULD be for each group/panel"""
+"""Debug: show what buffer values SHOULD be for each group/panel
+
+Mirrors busefb_column_offset()/busefb_pixel_offset() in the driver, for
+the 144x19 chain (4x32 + 16 half panel at the end) of busefb-overlay.dts.
+The KUnit suite (busefb_test.c) checks the driver against the same
+numbers.
+"""
 
 WIDTH = 144
 HEIGHT = 19
-PANELS = 5
-PANEL_COLS = 32
-FULL_PANEL_WIDTH = 128
+PANEL_WIDTHS = [32, 32, 32, 32, 16]  # image order, left to right
 GROUPS = 4
-COLS_PER_GROUP = PANEL_COLS // GROUPS  # 8
-REGS_PER_COL = 3
-DATA_BYTES_PER_PANEL = COLS_PER_GROUP * REGS_PER_COL  # 24
-PANEL_BYTES = DATA_BYTES_PER_PANEL + 1  # 25
-GROUP_BYTES = PANELS * PANEL_BYTES  # 125
-FRAME_BYTES = GROUPS * GROUP_BYTES  # 500
+REGS_PER_COL = (HEIGHT + 7) // 8  # 3
+
+def panel_bytes(width):
+    """Group select byte plus the registers of width / GROUPS columns"""
+    return 1 + width // GROUPS * REGS_PER_COL
 
-print(f"PANEL_BYTES={PANEL_BYTES}, GROUP_BYTES={GROUP_BYTES}, FRAME_BYTES={FRAME_BYTES}")
+# The chain is a FIFO: the panel furthest along the chain (the rightmost)
+# is sent first, so SPI order within a group is the reverse of image order.
+PANEL_OFF = [0] * len(PANEL_WIDTHS)
+off = 0
+for i in reversed(range(len(PANEL_WIDTHS))):
+    PANEL_OFF[i] = off
+    off += panel_bytes(PANEL_WIDTHS[i])
+GROUP_BYTES = off  # 113
+FRAME_BYTES = GROUPS * GROUP_BYTES  # 452
+
+print(f"GROUP_BYTES={GROUP_BYTES}, FRAME_BYTES={FRAME_BYTES}")
 print()
 
 # Simulate the driver's pixel mapping for a single lit pixel
 def map_pixel(x, y):
-    x_mirrored = WIDTH - 1 - x
+    panel = 0
+    panel_x = 0
+    while x >= panel_x + PANEL_WIDTHS[panel]:
+        panel_x += PANEL_WIDTHS[panel]
+        panel += 1
+    width = PANEL_WIDTHS[panel]
+    col_in_panel = x - panel_x
 
+    # Rows are stored bottom-up, MSB first, 8 rows per register
     y_rev = HEIGHT - 1 - y
     reg = y_rev // 8
     bit = 7 - (y_rev % 8)
 
-    if x < FULL_PANEL_WIDTH:
-        phys_panel = x // PANEL_COLS
-        buffer_panel = 3 - phys_panel  # reversed
-        col_in_panel = x % PANEL_COLS
-    else:
-        buffer_panel = 4
-        col_in_panel = x - FULL_PANEL_WIDTH
-
+    # Column groups are kept, column pairs are mirrored within the panel
     grp = col_in_panel % GROUPS
-    cp = (col_in_panel // GROUPS) ^ 0x01
-    base = grp * GROUP_BYTES + buffer_panel * PANEL_BYTES
+    cp = (width // GROUPS - 1) - col_in_panel // GROUPS
+    base = grp * GROUP_BYTES + PANEL_OFF[panel]
     data_offset = base + 1 + cp * REGS_PER_COL + reg
 
     return {
         'x': x,
         'y': y,
-        'buffer_panel': buffer_panel,
+        'panel': panel,
         'col_in_panel': col_in_panel,
         'grp': grp,
         'cp': cp,
@@ -52,25 +65,26 @@ def map_pixel(x, y):
         'data_bit': bit,
     }
 
-# Show mapping for half panel columns (128-143)
-print("=== HALF PANEL MAPPING (x=128-143) ===")
-print("x    | col_in | grp | cp | base | group_byte_pos | data_pos")
-print("-" * 65)
-for x in range(128, 144):
-    m = map_pixel(x, 0)
-    print(f"{x:3d}  | {m['col_in_panel']:6d} | {m['grp']:3d} | {m['cp']:2d} | {m['base']:4d} | {m['group_byte_pos']:14d} | {m['data_pos']:8d}")
+if __name__ == '__main__':
+    # Show mapping for half panel columns (128-143)
+    print("=== HALF PANEL MAPPING (x=128-143) ===")
+    print("x    | col_in | grp | cp | base | group_byte_pos | data_pos")
+    print("-" * 65)
+    for x in range(128, 144):
+        m = map_pixel(x, 0)
+        print(f"{x:3d}  | {m['col_in_panel']:6d} | {m['grp']:3d} | {m['cp']:2d} | {m['base']:4d} | {m['group_byte_pos']:14d} | {m['data_pos']:8d}")
 
-print()
-print("=== GROUP BYTE POSITIONS (first byte of each panel in each group) ===")
-for grp in range(GROUPS):
-    print(f"Group {grp}:", end=" ")
-    for panel in range(PANELS):
-        pos = grp * GROUP_BYTES + panel * PANEL_BYTES
-        print(f"panel{panel}@{pos}", end=" ")
     print()
+    print("=== GROUP BYTE POSITIONS (first byte of each panel in each group) ===")
+    for grp in range(GROUPS):
+        print(f"Group {grp}:", end=" ")
+        for panel in range(len(PANEL_WIDTHS)):
+            pos = grp * GROUP_BYTES + PANEL_OFF[panel]
+            print(f"panel{panel}@{pos}", end=" ")
+        print()
 
-print()
-print("=== FULL PANEL MAPPING (sample: x=0,32,64,96) ===")
-for x in [0, 32, 64, 96]:
-    m = map_pixel(x, 0)
-    print(f"x={x:3d} -> buffer_panel={m['buffer_panel']}, grp={m['grp']}, base={m['base']}")
+    print()
+    print("=== FULL PANEL MAPPING (sample: x=0,32,64,96) ===")
+    for x in [0, 32, 64, 96]:
+        m = map_pixel(x, 0)
+        print(f"x={x:3d} -> panel={m['panel']}, grp={m['grp']}, base={m['base']}")
@@ -1,6 +1,10 @@
 #!/usr/bin/env python3
 """Animated test - moving dot to check for panel/group issues"""
 
+import ctypes
+import fcntl
+import mmap
+import struct
 import time
 import sys
 
@@ -19,10 +23,90 @@ def set_pixel(fb, x, y):
         bit = idx & 7
         fb[byte_idx] |= (1 << bit)
 
+FBIOGET_VSCREENINFO = 0x4600
+FBIOPAN_DISPLAY = 0x4606
+VAR_YOFFSET = 20  # offset of yoffset in struct fb_var_screeninfo
+
+# Set by --mmap: frames are copied into the mapped framebuffer instead
+fb_map = None
+# Set by --flip: frames go to the back page, then FBIOPAN_DISPLAY
+fb_file = None
+fb_var = None
+front_page = 0
+# Set by --queue: frames are queued with a presentation time instead
+present_ns = None
+
+# Set by --vsync: sleeps are rounded to whole scan frames
+vsync_file = None
+vsync_period = None
+
+BUSEFB_IOCTL_QUEUE_FRAME = 0x40104205
+FBIO_WAITFORVSYNC = 0x40044620
+
+def wait_vsync():
+    fcntl.ioctl(vsync_file, FBIO_WAITFORVSYNC, struct.pack('I', 0))
+
+def open_vsync():
+    global vsync_file, vsync_period
+    vsync_file = open('/dev/fb0', 'r+b')
+    wait_vsync()
+    t = time.monotonic()
+    for _ in range(10):
+        wait_vsync()
+    vsync_period = (time.monotonic() - t) / 10
+    print(f"Scan frame period {vsync_period * 1000:.2f} ms")
+
+def frame_sleep(seconds):
+    """Time between frames: a real sleep, or the next presentation time"""
+    global present_ns
+    if present_ns is not None:
+        present_ns += int(seconds * 1e9)
+    elif vsync_file is not None:
+        for _ in range(max(1, round(seconds / vsync_period))):
+            wait_vsync()
+    else:
+        time.sleep(seconds)
+
 def write_fb(fb):
+    global front_page
+    if present_ns is not None:
+        # The driver copies the frame at the call, the ioctl blocks while
+        # its queue is full
+        data = bytes(fb)
+        buf = ctypes.create_string_buffer(data, len(data))
+        arg = struct.pack('QQ', present_ns, ctypes.addressof(buf))
+        fcntl.ioctl(fb_file, BUSEFB_IOCTL_QUEUE_FRAME, arg)
+        return
+    if fb_var is not None:
+        back = 1 - front_page
+        fb_map[back * FB_SIZE:(back + 1) * FB_SIZE] = fb
+        struct.pack_into('I', fb_var, VAR_YOFFSET, back * HEIGHT)
+        fcntl.ioctl(fb_file, FBIOPAN_DISPLAY, fb_var)
+        front_page = back
+        return
+    if fb_map is not None:
+        fb_map[:FB_SIZE] = fb
+        return
     with open('/dev/fb0', 'wb') as f:
         f.write(fb)
 
+def open_mmap(pages=1):
+    global fb_map, fb_file
+    fb_file = open('/dev/fb0', 'r+b')
+    fb_map = mmap.mmap(fb_file.fileno(), pages * FB_SIZE, mmap.MAP_SHARED,
+                       mmap.PROT_READ | mmap.PROT_WRITE)
+
+def open_queue():
+    global fb_file, present_ns
+    fb_file = open('/dev/fb0', 'r+b')
+    present_ns = time.clock_gettime_ns(time.CLOCK_MONOTONIC) + 100000000
+
+def open_flip():
+    global fb_var
+    open_mmap(pages=2)
+    fb_var = bytearray(160)
+    fcntl.ioctl(fb_file, FBIOGET_VSCREENINFO, fb_var)
+
 def test_horizontal_sweep():
     """Move a vertical line across the screen"""
     print("Horizontal sweep test - line should move smoothly left to right")
@@ -31,7 +115,7 @@ def test_horizontal_sweep():
         for y in range(HEIGHT):
             set_pixel(fb, x, y)
         write_fb(fb)
-        time.sleep(0.03)
+        frame_sleep(0.03)
 
 def test_ball_bounce():
     """Bouncing ball like pong"""
@@ -61,7 +145,7 @@ def test_ball_bounce():
         if y <= 0 or y >= HEIGHT - 2:
             dy = -dy
 
-        time.sleep(0.116)
+        frame_sleep(0.116)
 
 def test_group_check():
     """Light up one column at a time in each group to check ordering"""
@@ -72,7 +156,7 @@ def test_group_check():
             set_pixel(fb, x, y)
         write_fb(fb)
         print(f"Column {x} (group {x % 4})")
-        time.sleep(0.2)
+        frame_sleep(0.2)
 
 def test_four_columns():
     """Show 4 adjacent columns to check group ordering"""
@@ -104,9 +188,9 @@ def test_diagonal_fill():
             if 0 <= x < WIDTH:
                 set_pixel(fb, x, y)
         write_fb(fb)
-        time.sleep(0.02)
+        frame_sleep(0.02)
 
-    time.sleep(1)
+    frame_sleep(1)
 
 def test_pixel_march():
     """Light up one pixel at a time, row by row"""
@@ -116,7 +200,7 @@ def test_pixel_march():
             fb = create_fb()
             set_pixel(fb, x, y)
             write_fb(fb)
-            time.sleep(0.01)
+            frame_sleep(0.01)
 
 def test_row_fill():
     """Fill row by row from top"""
@@ -126,11 +210,24 @@ def test_row_fill():
         for x in range(WIDTH):
             set_pixel(fb, x, y)
         write_fb(fb)
-        time.sleep(0.1)
+        frame_sleep(0.1)
 
 if __name__ == '__main__':
+    if '--flip' in sys.argv:
+        sys.argv.remove('--flip')
+        open_flip()
+    elif '--mmap' in sys.argv:
+        sys.argv.remove('--mmap')
+        open_mmap()
+    elif '--queue' in sys.argv:
+        sys.argv.remove('--queue')
+        open_queue()
+    if '--vsync' in sys.argv:
+        sys.argv.remove('--vsync')
+        open_vsync()
+
     if len(sys.argv) < 2:
-        print("Usage: test_animation.py <test>")
+        print("Usage: test_animation.py [--mmap | --flip | --queue] [--vsync] <test>")
         print("  sweep  - horizontal line sweep")
         print("  ball   - bouncing ball")
         print("  group  - column by column")
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+"""8bpp grayscale test - a gradient, dithered to 1bpp by the driver"""
+
+import fcntl
+import struct
+import sys
+
+FBIOGET_VSCREENINFO = 0x4600
+FBIOPUT_VSCREENINFO = 0x4601
+VAR_BPP = 24  # offset of bits_per_pixel in struct fb_var_screeninfo
+DITHER = '/sys/bus/spi/devices/spi0.0/dither'
+
+def main():
+    mode = sys.argv[1] if len(sys.argv) > 1 else 'ordered'
+    with open(DITHER, 'w') as d:
+        d.write(mode + '\n')
+
+    with open('/dev/fb0', 'r+b') as f:
+        var = bytearray(160)
+        fcntl.ioctl(f, FBIOGET_VSCREENINFO, var)
+        xres, yres = struct.unpack_from('II', var, 0)
+        struct.pack_into('I', var, VAR_BPP, 8)
+        fcntl.ioctl(f, FBIOPUT_VSCREENINFO, var)
+
+        # Left to right, black to white
+        fb = bytearray(xres * yres)
+        for y in range(yres):
+            for x in range(xres):
+                fb[y * xres + x] = 255 * x // (xres - 1)
+        f.seek(0)
+        f.write(fb)
+        print(f"{xres}x{yres} 8bpp gradient, {mode} dither")
+
+if __name__ == '__main__':
+    main()
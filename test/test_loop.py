@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""Looped playback test - upload an animation, the driver plays it alone"""
+
+import ctypes
+import fcntl
+import struct
+import sys
+
+WIDTH = 144
+HEIGHT = 19
+FB_SIZE = WIDTH * HEIGHT // 8
+
+BUSEFB_IOCTL_LOOP = 0x40204207
+BUSEFB_IOCTL_LOOP_STOP = 0x4208
+BUSEFB_LOOP_VRAM = 1
+
+def set_pixel(fb, x, y):
+    if 0 <= x < WIDTH and 0 <= y < HEIGHT:
+        idx = y * WIDTH + x
+        fb[idx >> 3] |= 1 << (idx & 7)
+
+def sweep_frames():
+    """An 8 column bar crossing the screen, then a blink of the whole screen"""
+    frames, durations = [], []
+    for x in range(0, WIDTH, 4):
+        fb = bytearray(FB_SIZE)
+        for dx in range(8):
+            for y in range(HEIGHT):
+                set_pixel(fb, x + dx, y)
+        frames.append(fb)
+        durations.append(40)
+    frames.append(bytearray(b'\xff' * FB_SIZE))
+    durations.append(500)
+    frames.append(bytearray(FB_SIZE))
+    durations.append(500)
+    return frames, durations
+
+def main():
+    with open('/dev/fb0', 'r+b') as f:
+        if '--stop' in sys.argv:
+            fcntl.ioctl(f, BUSEFB_IOCTL_LOOP_STOP)
+            return
+
+        loops = int(sys.argv[1]) if len(sys.argv) > 1 else 0
+        frames, durations = sweep_frames()
+        data = ctypes.create_string_buffer(b''.join(frames))
+        ms = (ctypes.c_uint32 * len(durations))(*durations)
+        arg = struct.pack('QQIIII', ctypes.addressof(data),
+                          ctypes.addressof(ms), len(frames), loops,
+                          BUSEFB_LOOP_VRAM, 0)
+        fcntl.ioctl(f, BUSEFB_IOCTL_LOOP, arg)
+        print(f"{len(frames)} frames uploaded, "
+              f"{'looping until --stop' if not loops else f'{loops} loops'}")
+
+if __name__ == '__main__':
+    main()
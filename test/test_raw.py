@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Raw pass-through test - write pre-encoded SPI frames, bypassing VRAM"""
+
+import fcntl
+import mmap
+import struct
+import time
+import sys
+
+# Chain left to right, as in DT panel-widths
+PANELS = [32, 32, 32, 32, 16]
+HEIGHT = 19
+REGS_PER_COL = (HEIGHT + 7) // 8
+
+BUSEFB_IOCTL_RAW_INFO = 0x80184202
+BUSEFB_IOCTL_RAW_COMMIT = 0x4203
+BUSEFB_IOCTL_RAW_EXIT = 0x4204
+
+def raw_info(f):
+    buf = bytearray(24)
+    fcntl.ioctl(f, BUSEFB_IOCTL_RAW_INFO, buf)
+    return struct.unpack('QIIII', buf)
+
+def panel_offsets():
+    """Slot of each panel within a group, SPI order is reversed"""
+    offs = [0] * len(PANELS)
+    off = 0
+    for i in reversed(range(len(PANELS))):
+        offs[i] = off
+        off += 1 + PANELS[i] // 4 * REGS_PER_COL
+    return offs
+
+def build_frame(size, group_bytes, groups, lit_groups):
+    """All LEDs of lit_groups on, everything else off"""
+    frame = bytearray(size)
+    for g in range(groups):
+        base = g * group_bytes
+        if g in lit_groups:
+            frame[base:base + group_bytes] = b'\xff' * group_bytes
+        for off in panel_offsets():
+            frame[base + off] = g
+    return frame
+
+def main():
+    with open('/dev/fb0', 'r+b') as f:
+        offset, size, group_bytes, groups, planes = raw_info(f)
+        print(f"raw frame: {size} bytes, {groups} groups of {group_bytes}, "
+              f"{planes} planes")
+        if planes != 1:
+            print("expects 1bpp")
+            return
+        raw = mmap.mmap(f.fileno(), size, mmap.MAP_SHARED,
+                        mmap.PROT_READ | mmap.PROT_WRITE, offset=offset)
+
+        raw[:] = build_frame(size, group_bytes, groups, range(groups))
+        fcntl.ioctl(f, BUSEFB_IOCTL_RAW_COMMIT)
+        print("all on")
+        time.sleep(2)
+
+        for g in range(groups):
+            raw[:] = build_frame(size, group_bytes, groups, [g])
+            fcntl.ioctl(f, BUSEFB_IOCTL_RAW_COMMIT)
+            print(f"group {g}")
+            time.sleep(1)
+
+        if '--keep' not in sys.argv:
+            fcntl.ioctl(f, BUSEFB_IOCTL_RAW_EXIT)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Horizontal panning test - scroll a wide virtual framebuffer
+
+Needs virtual-width in DT. Draws numbered blocks across the whole
+virtual width, then pans it with FBIOPAN_DISPLAY (--pan) or hands it to
+the driver's auto-scroll (default).
+"""
+
+import fcntl
+import mmap
+import struct
+import sys
+import time
+
+FBIOGET_VSCREENINFO = 0x4600
+FBIOPAN_DISPLAY = 0x4606
+SCROLL_SPEED = '/sys/bus/spi/devices/spi0.0/scroll_speed'
+
+def main():
+    with open('/dev/fb0', 'r+b') as f:
+        var = bytearray(160)
+        fcntl.ioctl(f, FBIOGET_VSCREENINFO, var)
+        xres, yres, xres_virtual = struct.unpack_from('III', var, 0)
+        bpp = struct.unpack_from('I', var, 24)[0]
+        line = xres_virtual // 8
+        print(f"{xres}x{yres}, virtual width {xres_virtual}")
+        if bpp != 1:
+            print("expects 1bpp")
+            return
+
+        fb = mmap.mmap(f.fileno(), line * yres, mmap.MAP_SHARED,
+                       mmap.PROT_READ | mmap.PROT_WRITE)
+        # 8 column blocks, block n is n % yres rows high
+        page = bytearray(line * yres)
+        for b in range(xres_virtual // 8):
+            for y in range(yres - b % yres, yres):
+                page[y * line + b] = 0xff if b % 2 else 0x3c
+        fb[:] = page
+
+        if '--pan' in sys.argv:
+            for x in range(xres_virtual - xres + 1):
+                struct.pack_into('I', var, 16, x)  # xoffset
+                fcntl.ioctl(f, FBIOPAN_DISPLAY, var)
+                time.sleep(0.02)
+            return
+
+        with open(SCROLL_SPEED, 'w') as s:
+            s.write('50\n')
+        time.sleep(10)
+        with open(SCROLL_SPEED, 'w') as s:
+            s.write('-200\n')
+        time.sleep(3)
+        with open(SCROLL_SPEED, 'w') as s:
+            s.write('0\n')
+
+if __name__ == '__main__':
+    main()